@@ -0,0 +1,171 @@
+/*
+ * Input report decoding for the Valve Steam Controller HID driver
+ *
+ * Copyright (c) 2015 Clement Vuchener
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/*
+ * This file is also built in userspace by tools/sc-bench.c, which provides
+ * the integer types and the input_report_* functions before including it.
+ */
+
+#ifndef HID_VALVE_SC_DECODE_H
+#define HID_VALVE_SC_DECODE_H
+
+#ifdef __KERNEL__
+#include <linux/input.h>
+#endif
+
+/* Input report offsets */
+#define SC_OFFSET_TYPE		2
+#define SC_OFFSET_LENGTH	3
+#define SC_OFFSET_SEQNUM	4
+#define SC_OFFSET_BUTTONS	7
+#define SC_OFFSET_TRIGGERS_8	11
+#define SC_OFFSET_LEFT_AXES	16
+#define SC_OFFSET_RIGHT_AXES	20
+#define SC_OFFSET_TRIGGERS_16	24
+#define SC_OFFSET_ACCEL		28
+#define SC_OFFSET_GYRO		34
+#define SC_OFFSET_QUATERNION	40
+#define SC_OFFSET_LEFT_TOUCHPAD	58
+
+/* Button mask */
+#define SC_BTN_TOUCH_RIGHT	0x10000000
+#define SC_BTN_TOUCH_LEFT	0x08000000
+#define SC_BTN_CLICK_RIGHT	0x04000000
+#define SC_BTN_CLICK_LEFT	0x02000000
+#define SC_BTN_GRIP_RIGHT	0x01000000
+#define SC_BTN_GRIP_LEFT	0x00800000
+#define SC_BTN_START		0x00400000
+#define SC_BTN_MODE		0x00200000
+#define SC_BTN_SELECT		0x00100000
+#define SC_BTN_A		0x00008000
+#define SC_BTN_X		0x00004000
+#define SC_BTN_B		0x00002000
+#define SC_BTN_Y		0x00001000
+#define SC_BTN_SHOULDER_LEFT	0x00000800
+#define SC_BTN_SHOULDER_RIGHT	0x00000400
+#define SC_BTN_TRIGGER_LEFT	0x00000200
+#define SC_BTN_TRIGGER_RIGHT	0x00000100
+
+#define BTN_LEFTPAD_CLICK	(BTN_GAMEPAD+0xf)
+
+/* Fields of an input report */
+struct valve_sc_frame {
+	u32 buttons;
+	s16 left[2];
+	s16 right[2];
+	u8 triggers[2];
+	s16 accel[3];
+	s16 gyro[3];
+};
+
+#define SC_REPORT_BTN(input, buttons, sc_btn, code) \
+	input_report_key(input, code, (buttons & sc_btn ? 1 : 0))
+
+static inline void valve_sc_decode_frame(const u8 *raw_data,
+					 struct valve_sc_frame *frame)
+{
+	unsigned int i, axis;
+
+	memset(frame, 0, sizeof(*frame));
+
+	for (i = 0; i < sizeof(u32); ++i)
+		frame->buttons |= raw_data[SC_OFFSET_BUTTONS+i] << i*8;
+
+	for (axis = 0; axis < 2; ++axis) {
+		frame->triggers[axis] = raw_data[SC_OFFSET_TRIGGERS_8+axis];
+		for (i = 0; i < sizeof(s16); ++i) {
+			frame->left[axis] |= raw_data[SC_OFFSET_LEFT_AXES+2*axis+i] << i*8;
+			frame->right[axis] |= raw_data[SC_OFFSET_RIGHT_AXES+2*axis+i] << i*8;
+		}
+	}
+
+	for (axis = 0; axis < 3; ++axis) {
+		for (i = 0; i < sizeof(s16); ++i) {
+			frame->accel[axis] |= raw_data[SC_OFFSET_ACCEL+2*axis+i] << i*8;
+			frame->gyro[axis] |= raw_data[SC_OFFSET_GYRO+2*axis+i] << i*8;
+		}
+	}
+}
+
+static inline void valve_sc_report_input(struct input_dev *input,
+					 const struct valve_sc_frame *frame,
+					 bool center_touchpads)
+{
+	u32 buttons = frame->buttons;
+
+	if (buttons & SC_BTN_TOUCH_LEFT) {
+		input_report_abs(input, ABS_HAT0X, frame->left[0]);
+		input_report_abs(input, ABS_HAT0Y, -frame->left[1]);
+	} else if (center_touchpads &&
+		   frame->left[0] == 0 && frame->left[1] == 0) {
+		/* Left touch pad release is not detected if the stick
+		 * is not centered at the same time. Since they are used
+		 * with the same finger, it should not happen often.
+		 */
+		input_report_abs(input, ABS_HAT0X, 0);
+		input_report_abs(input, ABS_HAT0Y, 0);
+	}
+
+	if (center_touchpads || buttons & SC_BTN_TOUCH_RIGHT) {
+		input_report_abs(input, ABS_RX, frame->right[0]);
+		input_report_abs(input, ABS_RY, -frame->right[1]);
+	}
+
+	input_report_abs(input, ABS_HAT2Y, frame->triggers[0]);
+	input_report_abs(input, ABS_HAT2X, frame->triggers[1]);
+
+	if (buttons & SC_BTN_TOUCH_LEFT) {
+		/* Left events are touchpad events */
+		SC_REPORT_BTN(input, buttons,
+			      SC_BTN_CLICK_LEFT, BTN_LEFTPAD_CLICK);
+	} else {
+		/* Left events are stick events */
+		SC_REPORT_BTN(input, buttons,
+			      SC_BTN_CLICK_LEFT, BTN_THUMBL);
+		input_report_abs(input, ABS_X, frame->left[0]);
+		input_report_abs(input, ABS_Y, -frame->left[1]);
+	}
+	if (buttons & SC_BTN_TOUCH_RIGHT) {
+		SC_REPORT_BTN(input, buttons,
+			      SC_BTN_CLICK_RIGHT, BTN_THUMBR);
+	}
+	SC_REPORT_BTN(input, buttons, SC_BTN_A, BTN_SOUTH);
+	SC_REPORT_BTN(input, buttons, SC_BTN_B, BTN_EAST);
+	SC_REPORT_BTN(input, buttons, SC_BTN_X, BTN_WEST);
+	SC_REPORT_BTN(input, buttons, SC_BTN_Y, BTN_NORTH);
+	SC_REPORT_BTN(input, buttons, SC_BTN_SELECT, BTN_SELECT);
+	SC_REPORT_BTN(input, buttons, SC_BTN_MODE, BTN_MODE);
+	SC_REPORT_BTN(input, buttons, SC_BTN_START, BTN_START);
+	SC_REPORT_BTN(input, buttons, SC_BTN_SHOULDER_LEFT, BTN_TL);
+	SC_REPORT_BTN(input, buttons, SC_BTN_SHOULDER_RIGHT, BTN_TR);
+	SC_REPORT_BTN(input, buttons, SC_BTN_TRIGGER_LEFT, BTN_TL2);
+	SC_REPORT_BTN(input, buttons, SC_BTN_TRIGGER_RIGHT, BTN_TR2);
+	SC_REPORT_BTN(input, buttons, SC_BTN_GRIP_LEFT, BTN_C);
+	SC_REPORT_BTN(input, buttons, SC_BTN_GRIP_RIGHT, BTN_Z);
+
+	input_sync(input);
+}
+
+static inline void valve_sc_report_sensor(struct input_dev *sensor,
+					  const struct valve_sc_frame *frame)
+{
+	input_report_abs(sensor, ABS_X, frame->accel[0]);
+	input_report_abs(sensor, ABS_Y, frame->accel[1]);
+	input_report_abs(sensor, ABS_Z, frame->accel[2]);
+	input_report_abs(sensor, ABS_RX, frame->gyro[0]);
+	input_report_abs(sensor, ABS_RY, frame->gyro[1]);
+	input_report_abs(sensor, ABS_RZ, frame->gyro[2]);
+	input_sync(sensor);
+}
+
+#endif /* HID_VALVE_SC_DECODE_H */
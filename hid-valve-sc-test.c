@@ -0,0 +1,539 @@
+/*
+ * KUnit tests for the Valve Steam Controller HID driver
+ *
+ * Copyright (c) 2015 Clement Vuchener
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/*
+ * Included at the end of hid-valve-sc.c, so that the static functions can be
+ * tested. Frames go through valve_sc_raw_event on a device that is not bound
+ * to any hardware, and the events reaching a test input handler are checked.
+ */
+
+#include <kunit/test.h>
+
+#define SC_TEST_MAX_EVENTS	64
+#define SC_TEST_BENCH_FRAMES	100000
+
+struct valve_sc_test_event {
+	unsigned int type;
+	unsigned int code;
+	int value;
+};
+
+struct valve_sc_test {
+	struct hid_device hdev;
+	struct valve_sc_device sc;
+	struct input_handler handler;
+	struct input_handle handle;
+	struct valve_sc_test_event events[SC_TEST_MAX_EVENTS];
+	unsigned int count;
+	atomic_t link_runs;
+};
+
+static const struct input_device_id valve_sc_test_ids[] = {
+	{ .driver_info = 1 },
+	{ }
+};
+
+static bool valve_sc_test_match(struct input_handler *handler,
+				struct input_dev *dev)
+{
+	struct valve_sc_test *t = container_of(handler, struct valve_sc_test,
+					       handler);
+
+	return dev == valve_sc_owned(t->sc.input);
+}
+
+static int valve_sc_test_connect(struct input_handler *handler,
+				 struct input_dev *dev,
+				 const struct input_device_id *id)
+{
+	struct valve_sc_test *t = container_of(handler, struct valve_sc_test,
+					       handler);
+	int ret;
+
+	t->handle.dev = dev;
+	t->handle.handler = handler;
+	t->handle.name = "valve-sc-test";
+	ret = input_register_handle(&t->handle);
+	if (ret)
+		return ret;
+	ret = input_open_device(&t->handle);
+	if (ret)
+		input_unregister_handle(&t->handle);
+	return ret;
+}
+
+static void valve_sc_test_disconnect(struct input_handle *handle)
+{
+	input_close_device(handle);
+	input_unregister_handle(handle);
+}
+
+static void valve_sc_test_event(struct input_handle *handle,
+				unsigned int type, unsigned int code, int value)
+{
+	struct valve_sc_test *t = container_of(handle, struct valve_sc_test,
+					       handle);
+
+	if (t->count < SC_TEST_MAX_EVENTS) {
+		t->events[t->count].type = type;
+		t->events[t->count].code = code;
+		t->events[t->count].value = value;
+	}
+	++t->count;
+}
+
+/* The real link work would send feature requests to the missing hardware */
+static void valve_sc_test_link_work(struct work_struct *work)
+{
+	struct valve_sc_device *sc = container_of(to_delayed_work(work),
+						  struct valve_sc_device,
+						  link_work);
+	struct valve_sc_test *t = container_of(sc, struct valve_sc_test, sc);
+
+	atomic_inc(&t->link_runs);
+}
+
+static void valve_sc_test_release(struct device *dev)
+{
+}
+
+static int valve_sc_test_init(struct kunit *test)
+{
+	struct valve_sc_test *t;
+	struct valve_sc_device *sc;
+	int ret;
+
+	t = kunit_kzalloc(test, sizeof(*t), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, t);
+	sc = &t->sc;
+
+	device_initialize(&t->hdev.dev);
+	t->hdev.dev.release = valve_sc_test_release;
+	ret = dev_set_name(&t->hdev.dev, "valve-sc-test");
+	if (!ret)
+		ret = device_add(&t->hdev.dev);
+	if (ret) {
+		put_device(&t->hdev.dev);
+		KUNIT_FAIL(test, "Failed to add the test device: %d", ret);
+		return ret;
+	}
+	hid_set_drvdata(&t->hdev, sc);
+
+	sc->hdev = &t->hdev;
+	sc->parse_raw_report = true;
+	INIT_LIST_HEAD(&sc->registry);
+	spin_lock_init(&sc->frame_lock);
+	INIT_DELAYED_WORK(&sc->link_work, valve_sc_test_link_work);
+	sc->lifecycle_wq = alloc_ordered_workqueue("valve-sc-test", 0);
+	sc->stats = alloc_percpu(struct valve_sc_stats);
+	if (!sc->lifecycle_wq || !sc->stats) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	ret = valve_sc_init_input(sc);
+	if (ret)
+		goto err;
+
+	t->handler.name = "valve-sc-test";
+	t->handler.id_table = valve_sc_test_ids;
+	t->handler.match = valve_sc_test_match;
+	t->handler.connect = valve_sc_test_connect;
+	t->handler.disconnect = valve_sc_test_disconnect;
+	t->handler.event = valve_sc_test_event;
+	ret = input_register_handler(&t->handler);
+	if (ret) {
+		valve_sc_stop_device(sc);
+		goto err;
+	}
+
+	test->priv = t;
+	return 0;
+err:
+	free_percpu(sc->stats);
+	if (sc->lifecycle_wq)
+		destroy_workqueue(sc->lifecycle_wq);
+	device_del(&t->hdev.dev);
+	put_device(&t->hdev.dev);
+	KUNIT_FAIL(test, "Failed to set up the test device: %d", ret);
+	return ret;
+}
+
+static void valve_sc_test_exit(struct kunit *test)
+{
+	struct valve_sc_test *t = test->priv;
+	struct valve_sc_device *sc = &t->sc;
+
+	input_unregister_handler(&t->handler);
+	cancel_delayed_work_sync(&sc->link_work);
+	valve_sc_stop_device(sc);
+	destroy_workqueue(sc->lifecycle_wq);
+	free_percpu(sc->stats);
+	device_del(&t->hdev.dev);
+	put_device(&t->hdev.dev);
+}
+
+static void valve_sc_test_put16(u8 *raw, unsigned int offset, s16 value)
+{
+	raw[offset] = (u16)value & 0xff;
+	raw[offset+1] = (u16)value >> 8;
+}
+
+/* Sends an input report with the given buttons and pad or stick positions */
+static void valve_sc_test_input(struct valve_sc_test *t, u32 buttons,
+				s16 left_x, s16 left_y,
+				s16 right_x, s16 right_y)
+{
+	u8 raw[64] = {
+		[0] = 0x01,
+		[SC_OFFSET_TYPE] = 0x01,
+		[SC_OFFSET_LENGTH] = 60,
+	};
+	unsigned int i;
+
+	for (i = 0; i < sizeof(u32); ++i)
+		raw[SC_OFFSET_BUTTONS+i] = buttons >> i*8;
+	valve_sc_test_put16(raw, SC_OFFSET_LEFT_AXES, left_x);
+	valve_sc_test_put16(raw, SC_OFFSET_LEFT_AXES+2, left_y);
+	valve_sc_test_put16(raw, SC_OFFSET_RIGHT_AXES, right_x);
+	valve_sc_test_put16(raw, SC_OFFSET_RIGHT_AXES+2, right_y);
+	valve_sc_raw_event(&t->hdev, NULL, raw, sizeof(raw));
+}
+
+static void valve_sc_test_connection(struct valve_sc_test *t, u8 event)
+{
+	u8 raw[64] = {
+		[0] = 0x01,
+		[SC_OFFSET_TYPE] = 0x03,
+		[SC_OFFSET_LENGTH] = 1,
+		[4] = event,
+	};
+
+	valve_sc_raw_event(&t->hdev, NULL, raw, sizeof(raw));
+}
+
+/* Checks the events received since the last check */
+static void valve_sc_test_expect(struct kunit *test,
+				 const struct valve_sc_test_event *expected,
+				 unsigned int count)
+{
+	struct valve_sc_test *t = test->priv;
+	unsigned int i;
+
+	KUNIT_ASSERT_EQ(test, t->count, count);
+	for (i = 0; i < count; ++i) {
+		KUNIT_EXPECT_EQ_MSG(test, t->events[i].type, expected[i].type,
+				    "event %u", i);
+		KUNIT_EXPECT_EQ_MSG(test, t->events[i].code, expected[i].code,
+				    "event %u", i);
+		KUNIT_EXPECT_EQ_MSG(test, t->events[i].value, expected[i].value,
+				    "event %u", i);
+	}
+	t->count = 0;
+}
+
+#define SC_TEST_EXPECT(test, ...) do { \
+	static const struct valve_sc_test_event expected[] = { __VA_ARGS__ }; \
+	valve_sc_test_expect(test, expected, ARRAY_SIZE(expected)); \
+} while (0)
+
+#define SC_TEST_EXPECT_NONE(test) valve_sc_test_expect(test, NULL, 0)
+
+#define SC_TEST_SYN	{ EV_SYN, SYN_REPORT, 0 }
+
+#define valve_sc_test_stat(sc, field) \
+	valve_sc_stat_read(sc, offsetof(struct valve_sc_stats, field))
+
+static int valve_sc_test_abs(struct valve_sc_test *t, unsigned int code)
+{
+	return valve_sc_owned(t->sc.input)->absinfo[code].value;
+}
+
+static void valve_sc_test_stick(struct kunit *test)
+{
+	struct valve_sc_test *t = test->priv;
+
+	t->sc.center_touchpads = false;
+
+	/* The Y axes are negated */
+	valve_sc_test_input(t, 0, 1000, 2000, 0, 0);
+	SC_TEST_EXPECT(test,
+		       { EV_ABS, ABS_X, 1000 },
+		       { EV_ABS, ABS_Y, -2000 },
+		       SC_TEST_SYN);
+
+	/* Within the fuzz, nothing changes */
+	valve_sc_test_input(t, 0, 1020, 2000, 0, 0);
+	SC_TEST_EXPECT_NONE(test);
+
+	/* Without a touch, the left click is the stick click */
+	valve_sc_test_input(t, SC_BTN_CLICK_LEFT | SC_BTN_A, 1000, 2000, 0, 0);
+	SC_TEST_EXPECT(test,
+		       { EV_KEY, BTN_THUMBL, 1 },
+		       { EV_KEY, BTN_SOUTH, 1 },
+		       SC_TEST_SYN);
+
+	valve_sc_test_input(t, 0, 1000, 2000, 0, 0);
+	SC_TEST_EXPECT(test,
+		       { EV_KEY, BTN_THUMBL, 0 },
+		       { EV_KEY, BTN_SOUTH, 0 },
+		       SC_TEST_SYN);
+}
+
+static void valve_sc_test_left_pad(struct kunit *test)
+{
+	struct valve_sc_test *t = test->priv;
+
+	t->sc.center_touchpads = false;
+
+	/* With a touch, the left fields are the pad, not the stick */
+	valve_sc_test_input(t, SC_BTN_TOUCH_LEFT, 5000, 6000, 0, 0);
+	SC_TEST_EXPECT(test,
+		       { EV_ABS, ABS_HAT0X, 5000 },
+		       { EV_ABS, ABS_HAT0Y, -6000 },
+		       SC_TEST_SYN);
+
+	valve_sc_test_input(t, SC_BTN_TOUCH_LEFT | SC_BTN_CLICK_LEFT,
+			    5000, 6000, 0, 0);
+	SC_TEST_EXPECT(test,
+		       { EV_KEY, BTN_LEFTPAD_CLICK, 1 },
+		       SC_TEST_SYN);
+
+	valve_sc_test_input(t, SC_BTN_TOUCH_LEFT, 5000, 6000, 0, 0);
+	SC_TEST_EXPECT(test,
+		       { EV_KEY, BTN_LEFTPAD_CLICK, 0 },
+		       SC_TEST_SYN);
+
+	/* Not centered on release: the pad keeps its last position */
+	valve_sc_test_input(t, 0, 0, 0, 0, 0);
+	SC_TEST_EXPECT_NONE(test);
+	KUNIT_EXPECT_EQ(test, valve_sc_test_abs(t, ABS_HAT0X), 5000);
+	KUNIT_EXPECT_EQ(test, valve_sc_test_abs(t, ABS_X), 0);
+}
+
+static void valve_sc_test_right_pad(struct kunit *test)
+{
+	struct valve_sc_test *t = test->priv;
+
+	t->sc.center_touchpads = false;
+
+	/* Not touched and not centered: the right pad is not reported */
+	valve_sc_test_input(t, 0, 0, 0, 7000, 8000);
+	SC_TEST_EXPECT_NONE(test);
+
+	valve_sc_test_input(t, SC_BTN_TOUCH_RIGHT, 0, 0, 7000, 8000);
+	SC_TEST_EXPECT(test,
+		       { EV_ABS, ABS_RX, 7000 },
+		       { EV_ABS, ABS_RY, -8000 },
+		       SC_TEST_SYN);
+
+	valve_sc_test_input(t, SC_BTN_TOUCH_RIGHT | SC_BTN_CLICK_RIGHT,
+			    0, 0, 7000, 8000);
+	SC_TEST_EXPECT(test,
+		       { EV_KEY, BTN_THUMBR, 1 },
+		       SC_TEST_SYN);
+}
+
+static void valve_sc_test_center_touchpads(struct kunit *test)
+{
+	struct valve_sc_test *t = test->priv;
+
+	t->sc.center_touchpads = true;
+
+	valve_sc_test_input(t, SC_BTN_TOUCH_LEFT | SC_BTN_TOUCH_RIGHT,
+			    5000, 6000, 7000, 8000);
+	SC_TEST_EXPECT(test,
+		       { EV_ABS, ABS_HAT0X, 5000 },
+		       { EV_ABS, ABS_HAT0Y, -6000 },
+		       { EV_ABS, ABS_RX, 7000 },
+		       { EV_ABS, ABS_RY, -8000 },
+		       SC_TEST_SYN);
+
+	/* Both pads are centered on release */
+	valve_sc_test_input(t, 0, 0, 0, 0, 0);
+	SC_TEST_EXPECT(test,
+		       { EV_ABS, ABS_HAT0X, 0 },
+		       { EV_ABS, ABS_HAT0Y, 0 },
+		       { EV_ABS, ABS_RX, 0 },
+		       { EV_ABS, ABS_RY, 0 },
+		       SC_TEST_SYN);
+
+	/* The left release is missed when the stick is not centered */
+	valve_sc_test_input(t, SC_BTN_TOUCH_LEFT, 5000, 6000, 0, 0);
+	SC_TEST_EXPECT(test,
+		       { EV_ABS, ABS_HAT0X, 5000 },
+		       { EV_ABS, ABS_HAT0Y, -6000 },
+		       SC_TEST_SYN);
+	valve_sc_test_input(t, 0, 3000, 0, 0, 0);
+	SC_TEST_EXPECT(test,
+		       { EV_ABS, ABS_X, 3000 },
+		       SC_TEST_SYN);
+	KUNIT_EXPECT_EQ(test, valve_sc_test_abs(t, ABS_HAT0X), 5000);
+}
+
+static void valve_sc_test_connection_events(struct kunit *test)
+{
+	struct valve_sc_test *t = test->priv;
+	struct valve_sc_device *sc = &t->sc;
+
+	valve_sc_test_connection(t, 0x02);
+	KUNIT_EXPECT_TRUE(test, sc->connected);
+	KUNIT_EXPECT_TRUE(test, sc->first_event_pending);
+	flush_delayed_work(&sc->link_work);
+	KUNIT_EXPECT_EQ(test, atomic_read(&t->link_runs), 1);
+
+	/* A repeated state changes nothing */
+	valve_sc_test_connection(t, 0x02);
+	flush_delayed_work(&sc->link_work);
+	KUNIT_EXPECT_EQ(test, atomic_read(&t->link_runs), 1);
+
+	/* The first input report ends the reconnection */
+	valve_sc_test_input(t, 0, 0, 0, 0, 0);
+	KUNIT_EXPECT_FALSE(test, sc->first_event_pending);
+	KUNIT_EXPECT_GE(test, sc->reconnect_latency_last, 0);
+
+	/* Changes during the hold-off are applied by a single work run */
+	valve_sc_test_connection(t, 0x01);
+	KUNIT_EXPECT_FALSE(test, sc->connected);
+	valve_sc_test_connection(t, 0x02);
+	KUNIT_EXPECT_TRUE(test, sc->connected);
+	flush_delayed_work(&sc->link_work);
+	KUNIT_EXPECT_EQ(test, atomic_read(&t->link_runs), 2);
+
+	KUNIT_EXPECT_FALSE(test, sc->serial_stale);
+	valve_sc_test_connection(t, 0x03);
+	KUNIT_EXPECT_TRUE(test, sc->serial_stale);
+
+	KUNIT_EXPECT_EQ(test, valve_sc_test_stat(sc, frames_connection), 5);
+	KUNIT_EXPECT_EQ(test, valve_sc_test_stat(sc, frames_input), 1);
+	SC_TEST_EXPECT_NONE(test);
+}
+
+static void valve_sc_test_malformed(struct kunit *test)
+{
+	struct valve_sc_test *t = test->priv;
+	struct valve_sc_device *sc = &t->sc;
+	u8 raw[64] = {
+		[0] = 0x01,
+		[SC_OFFSET_TYPE] = 0x01,
+		[SC_OFFSET_LENGTH] = 59,
+		[SC_OFFSET_BUTTONS+1] = SC_BTN_A >> 8,
+	};
+
+	/* Only 64-byte reports are parsed */
+	valve_sc_raw_event(&t->hdev, NULL, raw, 32);
+	KUNIT_EXPECT_EQ(test, valve_sc_test_stat(sc, wrong_size), 1);
+	KUNIT_EXPECT_EQ(test, valve_sc_test_stat(sc, frames_input), 0);
+	SC_TEST_EXPECT_NONE(test);
+
+	/* A wrong length is counted, the report is still decoded */
+	valve_sc_raw_event(&t->hdev, NULL, raw, sizeof(raw));
+	KUNIT_EXPECT_EQ(test, valve_sc_test_stat(sc, bad_length), 1);
+	SC_TEST_EXPECT(test,
+		       { EV_KEY, BTN_SOUTH, 1 },
+		       SC_TEST_SYN);
+
+	raw[SC_OFFSET_TYPE] = 0x42;
+	valve_sc_raw_event(&t->hdev, NULL, raw, sizeof(raw));
+	KUNIT_EXPECT_EQ(test, valve_sc_test_stat(sc, frames_unknown), 1);
+	SC_TEST_EXPECT_NONE(test);
+
+	/* A muted slot reports nothing */
+	WRITE_ONCE(sc->muted, true);
+	valve_sc_test_input(t, 0, 1000, 0, 0, 0);
+	KUNIT_EXPECT_EQ(test, valve_sc_test_stat(sc, decode_skipped), 1);
+	SC_TEST_EXPECT_NONE(test);
+}
+
+/* Alternates between the left pad and the left stick paths */
+static const u8 valve_sc_test_bench_frames[2][64] = {
+	{
+		[0] = 0x01,
+		[SC_OFFSET_TYPE] = 0x01,
+		[SC_OFFSET_LENGTH] = 60,
+		[SC_OFFSET_BUTTONS+1] = SC_BTN_A >> 8,
+		[SC_OFFSET_BUTTONS+3] = (SC_BTN_TOUCH_LEFT | SC_BTN_TOUCH_RIGHT) >> 24,
+		[SC_OFFSET_TRIGGERS_8] = 0x80,
+		[SC_OFFSET_LEFT_AXES] = 0x10, 0x27, 0xf0, 0xd8,
+		[SC_OFFSET_RIGHT_AXES] = 0xf0, 0xd8, 0x10, 0x27,
+		[SC_OFFSET_ACCEL] = 0xe8, 0x03, 0x00, 0x00, 0x00, 0x40,
+		[SC_OFFSET_GYRO] = 0x64, 0x00, 0x9c, 0xff, 0x00, 0x00,
+	},
+	{
+		[0] = 0x01,
+		[SC_OFFSET_TYPE] = 0x01,
+		[SC_OFFSET_LENGTH] = 60,
+		[SC_OFFSET_BUTTONS+3] = SC_BTN_CLICK_LEFT >> 24,
+		[SC_OFFSET_TRIGGERS_8+1] = 0x80,
+		[SC_OFFSET_LEFT_AXES] = 0xf0, 0xd8, 0x10, 0x27,
+		[SC_OFFSET_ACCEL] = 0x18, 0xfc, 0x00, 0x00, 0x00, 0x40,
+	},
+};
+
+static void valve_sc_test_benchmark(struct kunit *test)
+{
+	struct valve_sc_test *t = test->priv;
+	struct valve_sc_device *sc = &t->sc;
+	struct input_dev *input = valve_sc_owned(sc->input);
+	ktime_t start;
+	u64 total = 0;
+	unsigned int i;
+
+	sc->center_touchpads = true;
+
+	start = ktime_get();
+	for (i = 0; i < SC_TEST_BENCH_FRAMES; ++i) {
+		/* Time the frames only, not the rescheduling */
+		if (i && i % 1024 == 0) {
+			total += ktime_to_ns(ktime_sub(ktime_get(), start));
+			cond_resched();
+			start = ktime_get();
+		}
+		valve_sc_raw_event(&t->hdev, NULL,
+				   (u8 *)valve_sc_test_bench_frames[i % 2], 64);
+	}
+	total += ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	kunit_info(test, "%u frames, %llu ns/frame\n", SC_TEST_BENCH_FRAMES,
+		   div_u64(total, SC_TEST_BENCH_FRAMES));
+
+	/* Every frame reached the input device, ending on the stick one */
+	KUNIT_EXPECT_EQ(test, valve_sc_test_stat(sc, frames_input),
+			SC_TEST_BENCH_FRAMES);
+	KUNIT_EXPECT_GE(test, t->count, SC_TEST_BENCH_FRAMES);
+	KUNIT_EXPECT_EQ(test, valve_sc_test_abs(t, ABS_X), -10000);
+	KUNIT_EXPECT_EQ(test, valve_sc_test_abs(t, ABS_Y), -10000);
+	KUNIT_EXPECT_EQ(test, valve_sc_test_abs(t, ABS_HAT2X), 0x80);
+	KUNIT_EXPECT_TRUE(test, test_bit(BTN_THUMBL, input->key));
+	KUNIT_EXPECT_FALSE(test, test_bit(BTN_SOUTH, input->key));
+}
+
+static struct kunit_case valve_sc_test_cases[] = {
+	KUNIT_CASE(valve_sc_test_stick),
+	KUNIT_CASE(valve_sc_test_left_pad),
+	KUNIT_CASE(valve_sc_test_right_pad),
+	KUNIT_CASE(valve_sc_test_center_touchpads),
+	KUNIT_CASE(valve_sc_test_connection_events),
+	KUNIT_CASE(valve_sc_test_malformed),
+	KUNIT_CASE(valve_sc_test_benchmark),
+	{ }
+};
+
+static struct kunit_suite valve_sc_test_suite = {
+	.name = "hid-valve-sc",
+	.init = valve_sc_test_init,
+	.exit = valve_sc_test_exit,
+	.test_cases = valve_sc_test_cases,
+};
+
+kunit_test_suite(valve_sc_test_suite);
@@ -0,0 +1,140 @@
+/*
+ * Tracepoints for the Valve Steam Controller HID driver
+ *
+ * Copyright (c) 2015 Clement Vuchener
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM valve_sc
+
+#if !defined(HID_VALVE_SC_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define HID_VALVE_SC_TRACE_H
+
+#include <linux/hid.h>
+#include <linux/tracepoint.h>
+#include <linux/version.h>
+
+/* __assign_str() takes its source from __string() since 6.10 */
+#ifndef valve_sc_assign_dev
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 10, 0)
+#define valve_sc_assign_dev(hdev)	__assign_str(dev)
+#else
+#define valve_sc_assign_dev(hdev)	__assign_str(dev, dev_name(&(hdev)->dev))
+#endif
+#endif
+
+TRACE_EVENT(valve_sc_frame,
+	TP_PROTO(struct hid_device *hdev, u8 type, u16 seqnum, s64 duration),
+	TP_ARGS(hdev, type, seqnum, duration),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(&hdev->dev))
+		__field(u8, type)
+		__field(u16, seqnum)
+		__field(s64, duration)
+	),
+
+	TP_fast_assign(
+		valve_sc_assign_dev(hdev);
+		__entry->type = type;
+		__entry->seqnum = seqnum;
+		__entry->duration = duration;
+	),
+
+	TP_printk("%s type=0x%02x seqnum=%u duration=%lldns",
+		  __get_str(dev), __entry->type, __entry->seqnum,
+		  __entry->duration)
+);
+
+TRACE_EVENT(valve_sc_request,
+	TP_PROTO(struct hid_device *hdev, u8 report_id, int reqtype,
+		 s64 duration, int result),
+	TP_ARGS(hdev, report_id, reqtype, duration, result),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(&hdev->dev))
+		__field(u8, report_id)
+		__field(int, reqtype)
+		__field(s64, duration)
+		__field(int, result)
+	),
+
+	TP_fast_assign(
+		valve_sc_assign_dev(hdev);
+		__entry->report_id = report_id;
+		__entry->reqtype = reqtype;
+		__entry->duration = duration;
+		__entry->result = result;
+	),
+
+	TP_printk("%s id=0x%02x %s duration=%lldns result=%d",
+		  __get_str(dev), __entry->report_id,
+		  __entry->reqtype == HID_REQ_GET_REPORT ? "get" : "set",
+		  __entry->duration, __entry->result)
+);
+
+TRACE_EVENT(valve_sc_link,
+	TP_PROTO(struct hid_device *hdev, bool connected, s64 duration),
+	TP_ARGS(hdev, connected, duration),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(&hdev->dev))
+		__field(bool, connected)
+		__field(s64, duration)
+	),
+
+	TP_fast_assign(
+		valve_sc_assign_dev(hdev);
+		__entry->connected = connected;
+		__entry->duration = duration;
+	),
+
+	TP_printk("%s %s duration=%lldns",
+		  __get_str(dev),
+		  __entry->connected ? "connect" : "disconnect",
+		  __entry->duration)
+);
+
+TRACE_EVENT(valve_sc_haptic,
+	TP_PROTO(struct hid_device *hdev, u8 actuator, u16 amplitude,
+		 u16 period, u16 count, int result),
+	TP_ARGS(hdev, actuator, amplitude, period, count, result),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(&hdev->dev))
+		__field(u8, actuator)
+		__field(u16, amplitude)
+		__field(u16, period)
+		__field(u16, count)
+		__field(int, result)
+	),
+
+	TP_fast_assign(
+		valve_sc_assign_dev(hdev);
+		__entry->actuator = actuator;
+		__entry->amplitude = amplitude;
+		__entry->period = period;
+		__entry->count = count;
+		__entry->result = result;
+	),
+
+	TP_printk("%s %s amplitude=%u period=%u count=%u result=%d",
+		  __get_str(dev), __entry->actuator ? "left" : "right",
+		  __entry->amplitude, __entry->period, __entry->count,
+		  __entry->result)
+);
+
+#endif /* HID_VALVE_SC_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE hid-valve-sc-trace
+#include <trace/define_trace.h>
@@ -11,14 +11,26 @@
  * any later version.
  */
 
-#define DEBUG
-
 #include <linux/hid.h>
 #include <linux/module.h>
 #include <linux/string.h>
 #include <linux/delay.h>
+#include <linux/usb.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+#include <linux/debugfs.h>
+#include <linux/vmalloc.h>
+#include <linux/overflow.h>
+#include <linux/uaccess.h>
+#include <linux/sched/signal.h>
 
 #include "hid-ids.h"
+#include "hid-valve-sc-decode.h"
+
+#define CREATE_TRACE_POINTS
+#include "hid-valve-sc-trace.h"
 
 #define to_hid_device(pdev) container_of(pdev, struct hid_device, dev)
 
@@ -45,41 +57,6 @@ static const u8 raw_report_desc[RAW_REPORT_DESC_SIZE] = {
 	0xC0,			/* End Collection */
 };
 
-/* Input report offsets */
-#define SC_OFFSET_TYPE		2
-#define SC_OFFSET_LENGTH	3
-#define SC_OFFSET_SEQNUM	4
-#define SC_OFFSET_BUTTONS	7
-#define SC_OFFSET_TRIGGERS_8	11
-#define SC_OFFSET_LEFT_AXES	16
-#define SC_OFFSET_RIGHT_AXES	20
-#define SC_OFFSET_TRIGGERS_16	24
-#define SC_OFFSET_ACCEL		28
-#define SC_OFFSET_GYRO		34
-#define SC_OFFSET_QUATERNION	40
-#define SC_OFFSET_LEFT_TOUCHPAD	58
-
-/* Button mask */
-#define SC_BTN_TOUCH_RIGHT	0x10000000
-#define SC_BTN_TOUCH_LEFT	0x08000000
-#define SC_BTN_CLICK_RIGHT	0x04000000
-#define SC_BTN_CLICK_LEFT	0x02000000
-#define SC_BTN_GRIP_RIGHT	0x01000000
-#define SC_BTN_GRIP_LEFT	0x00800000
-#define SC_BTN_START		0x00400000
-#define SC_BTN_MODE		0x00200000
-#define SC_BTN_SELECT		0x00100000
-#define SC_BTN_A		0x00008000
-#define SC_BTN_X		0x00004000
-#define SC_BTN_B		0x00002000
-#define SC_BTN_Y		0x00001000
-#define SC_BTN_SHOULDER_LEFT	0x00000800
-#define SC_BTN_SHOULDER_RIGHT	0x00000400
-#define SC_BTN_TRIGGER_LEFT	0x00000200
-#define SC_BTN_TRIGGER_RIGHT	0x00000100
-
-#define BTN_LEFTPAD_CLICK	(BTN_GAMEPAD+0xf)
-
 #define SC_FEATURE_REPORT_SIZE 65
 
 #define SC_FEATURE_DISABLE_AUTO_BUTTONS	0x81
@@ -106,29 +83,166 @@ static const u8 raw_report_desc[RAW_REPORT_DESC_SIZE] = {
 
 #define SC_RUMBLE_PERIOD	10000
 
+static unsigned int connect_holdoff = 50;
+module_param(connect_holdoff, uint, 0644);
+MODULE_PARM_DESC(connect_holdoff,
+		 "Delay in ms before applying a wireless connection change");
+
+static bool autosuspend = true;
+module_param(autosuspend, bool, 0644);
+MODULE_PARM_DESC(autosuspend,
+		 "Let wired controllers suspend when their devices are closed");
+
+enum {
+	SC_LIZARD_INPUT,
+	SC_LIZARD_HIDRAW,
+	SC_LIZARD_NONE,
+};
+
+static int lizard_interfaces = SC_LIZARD_INPUT;
+module_param(lizard_interfaces, int, 0444);
+MODULE_PARM_DESC(lizard_interfaces,
+		 "Keyboard and mouse interfaces binding (0: input devices, 1: hidraw only, 2: nothing)");
+
+static bool lazy_sensor;
+module_param(lazy_sensor, bool, 0644);
+MODULE_PARM_DESC(lazy_sensor,
+		 "Only create the sensor input device when enabled from sysfs");
+
+static unsigned int capture_frames;
+module_param(capture_frames, uint, 0444);
+MODULE_PARM_DESC(capture_frames,
+		 "Number of raw frames kept in each device capture ring (0 to disable, at most 65536)");
+
+#define SC_CAPTURE_MAX_FRAMES	65536
+/* Records copied from the ring with interrupts off at once */
+#define SC_CAPTURE_CHUNK	256
+
+#define SC_FEEDBACK_PERIOD	4000
+#define SC_FEEDBACK_COUNT	1
+
 struct valve_sc_haptic_params {
 	u16 left, right;
 	u16 period;
 	u16 count;
 };
 
+/* Per-CPU so that the frame path never contends on them */
+struct valve_sc_stats {
+	unsigned long frames_input;
+	unsigned long frames_connection;
+	unsigned long frames_unknown;
+	unsigned long bad_length;
+	unsigned long wrong_size;
+	unsigned long decode_skipped;
+	unsigned long control_errors;
+	unsigned long injected;
+};
+
+#define valve_sc_stat_inc(sc, field) this_cpu_inc((sc)->stats->field)
+
+/* Capture record format, as read from debugfs */
+struct valve_sc_capture_record {
+	__le64 timestamp;	/* CLOCK_MONOTONIC in ns */
+	u8 data[64];
+} __packed;
+
+/* Ring of the last raw frames received */
+struct valve_sc_capture {
+	spinlock_t lock;
+	unsigned int size;
+	unsigned int head;
+	unsigned int count;
+	/* Frames ever written, to find the overwritten ones */
+	unsigned long written;
+	struct valve_sc_capture_record records[];
+};
+
+/* Worst delay between queueing a work item and it starting to run */
+struct valve_sc_work_latency {
+	ktime_t queued;
+	s64 max;
+};
+
 struct valve_sc_device {
 	struct hid_device *hdev;
 	bool parse_raw_report;
+	bool wired;
+	bool open_on_demand;
+	bool muted;
+	struct list_head registry;
+	/* Serializes the reports from the device and from debugfs */
+	spinlock_t frame_lock;
 	bool connected;
-	struct input_dev *input;
-	struct input_dev *sensor;
+	bool removing;
+	bool serial_stale;
+	bool first_event_pending;
+	ktime_t connect_stamp;
+	s64 reconnect_latency_last;
+	s64 reconnect_latency_max;
+	s64 hotplug_latency;
+	/* Read under RCU by the frame path */
+	struct input_dev __rcu *input;
+	struct input_dev __rcu *sensor;
+	bool sensor_enabled;
+	struct work_struct sensor_work;
+	struct work_struct serial_work;
 	bool center_touchpads;
 	bool automouse;
 	bool autobuttons;
 	u8 orientation;
 	struct valve_sc_haptic_params haptic;
-	struct work_struct connect_work;
-	struct work_struct disconnect_work;
+	bool link_up;
+	atomic_t link_flaps;
+	struct delayed_work link_work;
 	struct work_struct haptic_work;
+	struct workqueue_struct *lifecycle_wq;
+	struct valve_sc_work_latency lifecycle_latency;
+	struct valve_sc_work_latency haptic_latency;
+	struct valve_sc_work_latency feedback_latency;
+	struct valve_sc_stats __percpu *stats;
+	struct valve_sc_capture *capture;
+	struct dentry *debugfs;
+	u32 inject_rate;
 	char *uniq;
+	/* Serializes the haptic reports of the rumble and click feedback */
+	struct mutex haptic_lock;
+	/* Click feedback */
+	u16 feedback_amplitude[2];
+	u32 feedback_buttons;
+	unsigned long feedback_pending;
+	ktime_t feedback_stamp[2];
+	s64 feedback_latency_last;
+	s64 feedback_latency_max;
+	struct work_struct feedback_work;
 };
 
+/* The input devices are only changed by probe, remove and the lifecycle
+ * work, which are serialized, and may be read there without RCU.
+ */
+#define valve_sc_owned(ptr)	rcu_dereference_protected(ptr, true)
+
+/* Haptic work is latency sensitive and shared by all devices */
+static struct workqueue_struct *valve_sc_haptic_wq;
+
+static bool valve_sc_queue_work(struct workqueue_struct *wq,
+				struct work_struct *work,
+				struct valve_sc_work_latency *latency)
+{
+	if (work_pending(work))
+		return false;
+	latency->queued = ktime_get();
+	return queue_work(wq, work);
+}
+
+static void valve_sc_work_started(struct valve_sc_work_latency *latency)
+{
+	s64 delay = ktime_to_ns(ktime_sub(ktime_get(), latency->queued));
+
+	if (delay > latency->max)
+		latency->max = delay;
+}
+
 static int valve_sc_send_request(struct valve_sc_device *sc, u8 report_id,
 				 const u8 *params, int params_size,
 				 u8 *answer, int *answer_size)
@@ -136,6 +250,7 @@ static int valve_sc_send_request(struct valve_sc_device *sc, u8 report_id,
 	int ret;
 	struct hid_device *hdev = sc->hdev;
 	u8 *report;
+	ktime_t start;
 
 	if (params_size > 62)
 		return -EINVAL;
@@ -149,8 +264,19 @@ static int valve_sc_send_request(struct valve_sc_device *sc, u8 report_id,
 	report[2] = params_size;
 	memcpy(&report[3], params, params_size);
 
+	/* Wake up the device if it was suspended while closed */
+	ret = hid_hw_power(hdev, PM_HINT_FULLON);
+	if (ret < 0) {
+		hid_warn(hdev, "Failed to resume device: %d\n", -ret);
+		kfree(report);
+		return ret;
+	}
+
+	start = ktime_get();
 	ret = hid_hw_raw_request(hdev, 0, report, SC_FEATURE_REPORT_SIZE,
 				 HID_FEATURE_REPORT, HID_REQ_SET_REPORT);
+	trace_valve_sc_request(hdev, report_id, HID_REQ_SET_REPORT,
+			       ktime_to_ns(ktime_sub(ktime_get(), start)), ret);
 	if (ret < 0) {
 		hid_warn(hdev, "Error sending feature: %d\n", -ret);
 		goto out;
@@ -168,8 +294,11 @@ static int valve_sc_send_request(struct valve_sc_device *sc, u8 report_id,
 
 	msleep(50);
 
+	start = ktime_get();
 	ret = hid_hw_raw_request(hdev, 0, report, SC_FEATURE_REPORT_SIZE,
 				 HID_FEATURE_REPORT, HID_REQ_GET_REPORT);
+	trace_valve_sc_request(hdev, report_id, HID_REQ_GET_REPORT,
+			       ktime_to_ns(ktime_sub(ktime_get(), start)), ret);
 	if (ret < 0) {
 		hid_warn(hdev, "Error receiving feature: %d\n", -ret);
 		goto out;
@@ -196,6 +325,9 @@ static int valve_sc_send_request(struct valve_sc_device *sc, u8 report_id,
 	ret = 0;
 
 out:
+	if (ret < 0)
+		valve_sc_stat_inc(sc, control_errors);
+	hid_hw_power(hdev, PM_HINT_NORMAL);
 	kfree(report);
 	return ret;
 }
@@ -303,6 +435,169 @@ static ssize_t valve_sc_store_center_touchpads(struct device *dev,
 		sc->center_touchpads = false;
 	else
 		return -EINVAL;
+	/* Pad states seen before the change are not edges to compare to */
+	sc->feedback_buttons = 0;
+	return count;
+}
+
+static ssize_t valve_sc_show_feedback(struct valve_sc_device *sc,
+				      u8 actuator, char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%u\n",
+			sc->feedback_amplitude[actuator]);
+}
+
+static ssize_t valve_sc_store_feedback(struct valve_sc_device *sc,
+				       u8 actuator, const char *buf,
+				       size_t count)
+{
+	int ret;
+	u16 amplitude;
+
+	ret = kstrtou16(buf, 0, &amplitude);
+	if (ret < 0)
+		return ret;
+
+	sc->feedback_amplitude[actuator] = amplitude;
+	/* Touches held while the feedback was off are new to it */
+	sc->feedback_buttons = 0;
+	return count;
+}
+
+static ssize_t valve_sc_show_feedback_left(struct device *dev,
+					   struct device_attribute *attr,
+					   char *buf)
+{
+	return valve_sc_show_feedback(dev_get_drvdata(dev),
+				      SC_HAPTIC_LEFT, buf);
+}
+
+static ssize_t valve_sc_store_feedback_left(struct device *dev,
+					    struct device_attribute *attr,
+					    const char *buf, size_t count)
+{
+	return valve_sc_store_feedback(dev_get_drvdata(dev),
+				       SC_HAPTIC_LEFT, buf, count);
+}
+
+static ssize_t valve_sc_show_feedback_right(struct device *dev,
+					    struct device_attribute *attr,
+					    char *buf)
+{
+	return valve_sc_show_feedback(dev_get_drvdata(dev),
+				      SC_HAPTIC_RIGHT, buf);
+}
+
+static ssize_t valve_sc_store_feedback_right(struct device *dev,
+					     struct device_attribute *attr,
+					     const char *buf, size_t count)
+{
+	return valve_sc_store_feedback(dev_get_drvdata(dev),
+				       SC_HAPTIC_RIGHT, buf, count);
+}
+
+static ssize_t valve_sc_show_feedback_latency(struct device *dev,
+					      struct device_attribute *attr,
+					      char *buf)
+{
+	struct valve_sc_device *sc = dev_get_drvdata(dev);
+
+	/* Last and worst frame-to-pulse latency in microseconds */
+	return snprintf(buf, PAGE_SIZE, "%lld %lld\n",
+			div_s64(sc->feedback_latency_last, NSEC_PER_USEC),
+			div_s64(sc->feedback_latency_max, NSEC_PER_USEC));
+}
+
+static ssize_t valve_sc_show_work_latency(struct device *dev,
+					  struct device_attribute *attr,
+					  char *buf)
+{
+	struct valve_sc_device *sc = dev_get_drvdata(dev);
+
+	/* Worst queue-to-run delays in microseconds */
+	return snprintf(buf, PAGE_SIZE, "%lld %lld %lld\n",
+			div_s64(sc->lifecycle_latency.max, NSEC_PER_USEC),
+			div_s64(sc->haptic_latency.max, NSEC_PER_USEC),
+			div_s64(sc->feedback_latency.max, NSEC_PER_USEC));
+}
+
+static ssize_t valve_sc_store_work_latency(struct device *dev,
+					   struct device_attribute *attr,
+					   const char *buf, size_t count)
+{
+	struct valve_sc_device *sc = dev_get_drvdata(dev);
+
+	sc->lifecycle_latency.max = 0;
+	sc->haptic_latency.max = 0;
+	sc->feedback_latency.max = 0;
+	return count;
+}
+
+static ssize_t valve_sc_show_reconnect_latency(struct device *dev,
+					       struct device_attribute *attr,
+					       char *buf)
+{
+	struct valve_sc_device *sc = dev_get_drvdata(dev);
+
+	/* Last and worst connection-to-first-event latency in microseconds */
+	return snprintf(buf, PAGE_SIZE, "%lld %lld\n",
+			div_s64(sc->reconnect_latency_last, NSEC_PER_USEC),
+			div_s64(sc->reconnect_latency_max, NSEC_PER_USEC));
+}
+
+static ssize_t valve_sc_show_connection_flaps(struct device *dev,
+					      struct device_attribute *attr,
+					      char *buf)
+{
+	struct valve_sc_device *sc = dev_get_drvdata(dev);
+
+	return snprintf(buf, PAGE_SIZE, "%d\n", atomic_read(&sc->link_flaps));
+}
+
+static ssize_t valve_sc_show_hotplug_latency(struct device *dev,
+					     struct device_attribute *attr,
+					     char *buf)
+{
+	struct valve_sc_device *sc = dev_get_drvdata(dev);
+
+	/* Time from the device being added to the end of probe */
+	return snprintf(buf, PAGE_SIZE, "%lld\n",
+			div_s64(sc->hotplug_latency, NSEC_PER_USEC));
+}
+
+static ssize_t valve_sc_show_muted(struct device *dev,
+				   struct device_attribute *attr,
+				   char *buf)
+{
+	struct valve_sc_device *sc = dev_get_drvdata(dev);
+
+	return snprintf(buf, PAGE_SIZE, "%s\n", sc->muted ? "on" : "off");
+}
+
+static ssize_t valve_sc_show_sensor(struct device *dev,
+				    struct device_attribute *attr,
+				    char *buf)
+{
+	struct valve_sc_device *sc = dev_get_drvdata(dev);
+
+	return snprintf(buf, PAGE_SIZE, "%s\n", sc->sensor_enabled ? "on" : "off");
+}
+
+static ssize_t valve_sc_store_sensor(struct device *dev,
+				     struct device_attribute *attr,
+				     const char *buf, size_t count)
+{
+	struct valve_sc_device *sc = dev_get_drvdata(dev);
+
+	if (strncmp(buf, "on", 2) == 0)
+		sc->sensor_enabled = true;
+	else if (strncmp(buf, "off", 3) == 0)
+		sc->sensor_enabled = false;
+	else
+		return -EINVAL;
+
+	/* Serialized with connection changes */
+	queue_work(sc->lifecycle_wq, &sc->sensor_work);
 	return count;
 }
 
@@ -312,11 +607,37 @@ static DEVICE_ATTR(autobuttons, 0644,
 		   valve_sc_show_autobuttons, valve_sc_store_autobuttons);
 static DEVICE_ATTR(center_touchpads, 0644,
 		   valve_sc_show_center_touchpads, valve_sc_store_center_touchpads);
+static DEVICE_ATTR(sensor, 0644,
+		   valve_sc_show_sensor, valve_sc_store_sensor);
+static DEVICE_ATTR(click_feedback_left, 0644,
+		   valve_sc_show_feedback_left, valve_sc_store_feedback_left);
+static DEVICE_ATTR(click_feedback_right, 0644,
+		   valve_sc_show_feedback_right, valve_sc_store_feedback_right);
+static DEVICE_ATTR(click_feedback_latency, 0444,
+		   valve_sc_show_feedback_latency, NULL);
+static DEVICE_ATTR(reconnect_latency, 0444,
+		   valve_sc_show_reconnect_latency, NULL);
+static DEVICE_ATTR(connection_flaps, 0444,
+		   valve_sc_show_connection_flaps, NULL);
+static DEVICE_ATTR(hotplug_latency, 0444,
+		   valve_sc_show_hotplug_latency, NULL);
+static DEVICE_ATTR(muted, 0444, valve_sc_show_muted, NULL);
+static DEVICE_ATTR(work_latency, 0644,
+		   valve_sc_show_work_latency, valve_sc_store_work_latency);
 
 static struct attribute *valve_sc_attrs[] = {
 	&dev_attr_automouse.attr,
 	&dev_attr_autobuttons.attr,
 	&dev_attr_center_touchpads.attr,
+	&dev_attr_sensor.attr,
+	&dev_attr_click_feedback_left.attr,
+	&dev_attr_click_feedback_right.attr,
+	&dev_attr_click_feedback_latency.attr,
+	&dev_attr_reconnect_latency.attr,
+	&dev_attr_connection_flaps.attr,
+	&dev_attr_hotplug_latency.attr,
+	&dev_attr_muted.attr,
+	&dev_attr_work_latency.attr,
 	NULL
 };
 
@@ -324,100 +645,108 @@ static const struct attribute_group valve_sc_attr_group = {
 	.attrs = valve_sc_attrs,
 };
 
-#define SC_REPORT_BTN(input, buttons, sc_btn, code) \
-	input_report_key(input, code, (buttons & sc_btn ? 1 : 0))
+static unsigned long valve_sc_stat_read(struct valve_sc_device *sc,
+					size_t offset)
+{
+	unsigned long sum = 0;
+	int cpu;
 
-static void valve_sc_parse_input_events(struct valve_sc_device *sc,
-					const u8 *raw_data)
+	for_each_possible_cpu(cpu)
+		sum += *(unsigned long *)((u8 *)per_cpu_ptr(sc->stats, cpu) +
+					  offset);
+	return sum;
+}
+
+#define VALVE_SC_STAT_ATTR(field) \
+static ssize_t valve_sc_show_##field(struct device *dev, \
+				     struct device_attribute *attr, \
+				     char *buf) \
+{ \
+	struct valve_sc_device *sc = dev_get_drvdata(dev); \
+ \
+	return snprintf(buf, PAGE_SIZE, "%lu\n", \
+			valve_sc_stat_read(sc, offsetof(struct valve_sc_stats, \
+							field))); \
+} \
+static DEVICE_ATTR(field, 0444, valve_sc_show_##field, NULL)
+
+VALVE_SC_STAT_ATTR(frames_input);
+VALVE_SC_STAT_ATTR(frames_connection);
+VALVE_SC_STAT_ATTR(frames_unknown);
+VALVE_SC_STAT_ATTR(bad_length);
+VALVE_SC_STAT_ATTR(wrong_size);
+VALVE_SC_STAT_ATTR(decode_skipped);
+VALVE_SC_STAT_ATTR(control_errors);
+VALVE_SC_STAT_ATTR(injected);
+
+static struct attribute *valve_sc_stats_attrs[] = {
+	&dev_attr_frames_input.attr,
+	&dev_attr_frames_connection.attr,
+	&dev_attr_frames_unknown.attr,
+	&dev_attr_bad_length.attr,
+	&dev_attr_wrong_size.attr,
+	&dev_attr_decode_skipped.attr,
+	&dev_attr_control_errors.attr,
+	&dev_attr_injected.attr,
+	NULL
+};
+
+static const struct attribute_group valve_sc_stats_group = {
+	.name = "statistics",
+	.attrs = valve_sc_stats_attrs,
+};
+
+static const struct attribute_group *valve_sc_attr_groups[] = {
+	&valve_sc_attr_group,
+	&valve_sc_stats_group,
+	NULL
+};
+
+static void valve_sc_queue_feedback(struct valve_sc_device *sc, u32 buttons)
 {
-	unsigned int i, axis;
-	u32 buttons = 0;
-	s16 left[2] = {0}, right[2] = {0};
-	u8 triggers[2] = {0};
-	s16 accel[3] = {0};
-	s16 gyro[3] = {0};
-
-	/* Read fields */
-	for (i = 0; i < sizeof(u32); ++i)
-		buttons |= raw_data[SC_OFFSET_BUTTONS+i] << i*8;
-
-	for (axis = 0; axis < 2; ++axis) {
-		triggers[axis] = raw_data[SC_OFFSET_TRIGGERS_8+axis];
-		for (i = 0; i < sizeof(s16); ++i) {
-			left[axis] |= raw_data[SC_OFFSET_LEFT_AXES+2*axis+i] << i*8;
-			right[axis] |= raw_data[SC_OFFSET_RIGHT_AXES+2*axis+i] << i*8;
-		}
-	}
+	u32 pressed = buttons & ~sc->feedback_buttons;
+	bool queued = false;
 
-	for (axis = 0; axis < 3; ++axis) {
-		for (i = 0; i < sizeof(s16); ++i) {
-			accel[axis] |= raw_data[SC_OFFSET_ACCEL+2*axis+i] << i*8;
-			gyro[axis] |= raw_data[SC_OFFSET_GYRO+2*axis+i] << i*8;
-		}
+	sc->feedback_buttons = buttons;
+
+	/* The left click is a stick click when the pad is not touched */
+	if (!(buttons & SC_BTN_TOUCH_LEFT))
+		pressed &= ~SC_BTN_CLICK_LEFT;
+
+	if (sc->feedback_amplitude[SC_HAPTIC_LEFT] &&
+	    pressed & (SC_BTN_TOUCH_LEFT | SC_BTN_CLICK_LEFT) &&
+	    !test_and_set_bit(SC_HAPTIC_LEFT, &sc->feedback_pending)) {
+		sc->feedback_stamp[SC_HAPTIC_LEFT] = ktime_get();
+		queued = true;
+	}
+	if (sc->feedback_amplitude[SC_HAPTIC_RIGHT] &&
+	    pressed & (SC_BTN_TOUCH_RIGHT | SC_BTN_CLICK_RIGHT) &&
+	    !test_and_set_bit(SC_HAPTIC_RIGHT, &sc->feedback_pending)) {
+		sc->feedback_stamp[SC_HAPTIC_RIGHT] = ktime_get();
+		queued = true;
 	}
 
-	if (sc->input) {
-		if (buttons & SC_BTN_TOUCH_LEFT) {
-			input_report_abs(sc->input, ABS_HAT0X, left[0]);
-			input_report_abs(sc->input, ABS_HAT0Y, -left[1]);
-		} else if (sc->center_touchpads && left[0] == 0 && left[1] == 0) {
-			/* Left touch pad release is not detected if the stick
-			 * is not centered at the same time. Since they are used
-			 * with the same finger, it should not happen often.
-			 */
-			input_report_abs(sc->input, ABS_HAT0X, 0);
-			input_report_abs(sc->input, ABS_HAT0Y, 0);
-		}
+	if (queued)
+		valve_sc_queue_work(valve_sc_haptic_wq, &sc->feedback_work,
+				    &sc->feedback_latency);
+}
 
-		if (sc->center_touchpads || buttons & SC_BTN_TOUCH_RIGHT) {
-			input_report_abs(sc->input, ABS_RX, right[0]);
-			input_report_abs(sc->input, ABS_RY, -right[1]);
-		}
+static void valve_sc_parse_input_events(struct valve_sc_device *sc,
+					struct input_dev *input,
+					struct input_dev *sensor,
+					const u8 *raw_data)
+{
+	struct valve_sc_frame frame;
 
-		input_report_abs(sc->input, ABS_HAT2Y, triggers[0]);
-		input_report_abs(sc->input, ABS_HAT2X, triggers[1]);
+	valve_sc_decode_frame(raw_data, &frame);
 
-		if (buttons & SC_BTN_TOUCH_LEFT) {
-			/* Left events are touchpad events */
-			SC_REPORT_BTN(sc->input, buttons,
-				      SC_BTN_CLICK_LEFT, BTN_LEFTPAD_CLICK);
-		} else {
-			/* Left events are stick events */
-			SC_REPORT_BTN(sc->input, buttons,
-				      SC_BTN_CLICK_LEFT, BTN_THUMBL);
-			input_report_abs(sc->input, ABS_X, left[0]);
-			input_report_abs(sc->input, ABS_Y, -left[1]);
-		}
-		if (buttons & SC_BTN_TOUCH_RIGHT) {
-			SC_REPORT_BTN(sc->input, buttons,
-				      SC_BTN_CLICK_RIGHT, BTN_THUMBR);
-		}
-		SC_REPORT_BTN(sc->input, buttons, SC_BTN_A, BTN_SOUTH);
-		SC_REPORT_BTN(sc->input, buttons, SC_BTN_B, BTN_EAST);
-		SC_REPORT_BTN(sc->input, buttons, SC_BTN_X, BTN_WEST);
-		SC_REPORT_BTN(sc->input, buttons, SC_BTN_Y, BTN_NORTH);
-		SC_REPORT_BTN(sc->input, buttons, SC_BTN_SELECT, BTN_SELECT);
-		SC_REPORT_BTN(sc->input, buttons, SC_BTN_MODE, BTN_MODE);
-		SC_REPORT_BTN(sc->input, buttons, SC_BTN_START, BTN_START);
-		SC_REPORT_BTN(sc->input, buttons, SC_BTN_SHOULDER_LEFT, BTN_TL);
-		SC_REPORT_BTN(sc->input, buttons, SC_BTN_SHOULDER_RIGHT, BTN_TR);
-		SC_REPORT_BTN(sc->input, buttons, SC_BTN_TRIGGER_LEFT, BTN_TL2);
-		SC_REPORT_BTN(sc->input, buttons, SC_BTN_TRIGGER_RIGHT, BTN_TR2);
-		SC_REPORT_BTN(sc->input, buttons, SC_BTN_GRIP_LEFT, BTN_C);
-		SC_REPORT_BTN(sc->input, buttons, SC_BTN_GRIP_RIGHT, BTN_Z);
-
-		input_sync(sc->input);
-	}
-
-	if (sc->sensor) {
-		input_report_abs(sc->sensor, ABS_X, accel[0]);
-		input_report_abs(sc->sensor, ABS_Y, accel[1]);
-		input_report_abs(sc->sensor, ABS_Z, accel[2]);
-		input_report_abs(sc->sensor, ABS_RX, gyro[0]);
-		input_report_abs(sc->sensor, ABS_RY, gyro[1]);
-		input_report_abs(sc->sensor, ABS_RZ, gyro[2]);
-		input_sync(sc->sensor);
-	}
+	valve_sc_queue_feedback(sc, frame.buttons);
+
+	if (input)
+		valve_sc_report_input(input, &frame, sc->center_touchpads);
+
+	if (sensor)
+		valve_sc_report_sensor(sensor, &frame);
 }
 
 static int valve_sc_play_effect(struct input_dev *dev, void *data,
@@ -435,13 +764,15 @@ static int valve_sc_play_effect(struct input_dev *dev, void *data,
 		sc->haptic.count = 0xffff;
 	else
 		sc->haptic.count = 0;
-	schedule_work(&sc->haptic_work);
+	valve_sc_queue_work(valve_sc_haptic_wq, &sc->haptic_work,
+			    &sc->haptic_latency);
 	return 0;
 }
 
 static int valve_sc_haptic_effect(struct valve_sc_device *sc, u8 actuator,
 				  u16 amplitude, u16 period, u16 count)
 {
+	int ret;
 	u8 params[7];
 
 	params[0] = actuator;
@@ -451,9 +782,11 @@ static int valve_sc_haptic_effect(struct valve_sc_device *sc, u8 actuator,
 	params[4] = period >> 8;
 	params[5] = count & 0xff;
 	params[6] = count >> 8;
-	return valve_sc_send_request(sc, SC_FEATURE_HAPTIC,
-				     params, sizeof(params),
-				     NULL, NULL);
+	ret = valve_sc_send_request(sc, SC_FEATURE_HAPTIC,
+				    params, sizeof(params),
+				    NULL, NULL);
+	trace_valve_sc_haptic(sc->hdev, actuator, amplitude, period, count, ret);
+	return ret;
 }
 
 static void valve_sc_haptic_work(struct work_struct *work)
@@ -461,90 +794,166 @@ static void valve_sc_haptic_work(struct work_struct *work)
 	struct valve_sc_device *sc = container_of(work, struct valve_sc_device,
 						  haptic_work);
 
+	valve_sc_work_started(&sc->haptic_latency);
+	if (!sc->connected)
+		return;
+
+	mutex_lock(&sc->haptic_lock);
 	valve_sc_haptic_effect(sc, SC_HAPTIC_LEFT, sc->haptic.left,
 			       sc->haptic.period, sc->haptic.count);
 	valve_sc_haptic_effect(sc, SC_HAPTIC_RIGHT, sc->haptic.right,
 			       sc->haptic.period, sc->haptic.count);
+	mutex_unlock(&sc->haptic_lock);
+}
+
+/* A pulse would end the rumble played by the same actuator */
+static bool valve_sc_rumbling(struct valve_sc_device *sc, u8 actuator)
+{
+	if (actuator == SC_HAPTIC_LEFT)
+		return sc->haptic.count && sc->haptic.left;
+	return sc->haptic.count && sc->haptic.right;
+}
+
+static void valve_sc_feedback_work(struct work_struct *work)
+{
+	struct valve_sc_device *sc = container_of(work, struct valve_sc_device,
+						  feedback_work);
+	u8 actuator;
+	ktime_t stamp;
+	s64 latency;
+
+	valve_sc_work_started(&sc->feedback_latency);
+
+	/* The haptic work runs concurrently on the same workqueue */
+	mutex_lock(&sc->haptic_lock);
+	for (actuator = SC_HAPTIC_RIGHT; actuator <= SC_HAPTIC_LEFT; ++actuator) {
+		if (!test_bit(actuator, &sc->feedback_pending))
+			continue;
+		stamp = sc->feedback_stamp[actuator];
+		clear_bit(actuator, &sc->feedback_pending);
+
+		if (!sc->connected || valve_sc_rumbling(sc, actuator))
+			continue;
+
+		if (valve_sc_haptic_effect(sc, actuator,
+					   sc->feedback_amplitude[actuator],
+					   SC_FEEDBACK_PERIOD,
+					   SC_FEEDBACK_COUNT) < 0)
+			continue;
+
+		latency = ktime_to_ns(ktime_sub(ktime_get(), stamp));
+		sc->feedback_latency_last = latency;
+		if (latency > sc->feedback_latency_max)
+			sc->feedback_latency_max = latency;
+	}
+	mutex_unlock(&sc->haptic_lock);
+}
+
+/* Wired devices are only opened while one of their input devices is */
+static int valve_sc_hw_open(struct valve_sc_device *sc)
+{
+	if (!sc->open_on_demand)
+		return 0;
+	return hid_hw_open(sc->hdev);
+}
+
+static void valve_sc_hw_close(struct valve_sc_device *sc)
+{
+	if (sc->open_on_demand)
+		hid_hw_close(sc->hdev);
+}
+
+static int valve_sc_open_input(struct input_dev *dev)
+{
+	return valve_sc_hw_open(input_get_drvdata(dev));
+}
+
+static void valve_sc_close_input(struct input_dev *dev)
+{
+	valve_sc_hw_close(input_get_drvdata(dev));
 }
 
 static int valve_sc_init_input(struct valve_sc_device *sc)
 {
 	int ret;
 	struct hid_device *hdev = sc->hdev;
+	struct input_dev *input;
 
-	sc->input = input_allocate_device();
-	if (!sc->input) {
+	input = input_allocate_device();
+	if (!input) {
 		hid_err(hdev, "Failed to allocate input device.\n");
 		return -ENOMEM;
 	}
 
-	input_set_drvdata(sc->input, sc);
-	sc->input->dev.parent = &hdev->dev;
-	sc->input->id.bustype = hdev->bus;
-	sc->input->id.vendor = hdev->vendor;
-	sc->input->id.product = hdev->product;
-	sc->input->id.version = hdev->version;
-	sc->input->name = CONTROLLER_NAME;
+	input_set_drvdata(input, sc);
+	input->dev.parent = &hdev->dev;
+	input->open = valve_sc_open_input;
+	input->close = valve_sc_close_input;
+	input->id.bustype = hdev->bus;
+	input->id.vendor = hdev->vendor;
+	input->id.product = hdev->product;
+	input->id.version = hdev->version;
+	input->name = CONTROLLER_NAME;
 	if (sc->uniq)
-		sc->input->uniq = sc->uniq;
-
-	set_bit(EV_KEY, sc->input->evbit);
-	set_bit(BTN_SOUTH, sc->input->keybit);
-	set_bit(BTN_EAST, sc->input->keybit);
-	set_bit(BTN_WEST, sc->input->keybit);
-	set_bit(BTN_NORTH, sc->input->keybit);
-	set_bit(BTN_SELECT, sc->input->keybit);
-	set_bit(BTN_MODE, sc->input->keybit);
-	set_bit(BTN_START, sc->input->keybit);
-	set_bit(BTN_TL, sc->input->keybit);
-	set_bit(BTN_TR, sc->input->keybit);
-	set_bit(BTN_TL2, sc->input->keybit);
-	set_bit(BTN_TR2, sc->input->keybit);
-	set_bit(BTN_C, sc->input->keybit); /* Left grip */
-	set_bit(BTN_Z, sc->input->keybit); /* Right grip */
-	set_bit(BTN_LEFTPAD_CLICK, sc->input->keybit);
-	set_bit(BTN_THUMBR, sc->input->keybit);
-	set_bit(BTN_THUMBL, sc->input->keybit);
-
-	set_bit(EV_ABS, sc->input->evbit);
+		input->uniq = sc->uniq;
+
+	set_bit(EV_KEY, input->evbit);
+	set_bit(BTN_SOUTH, input->keybit);
+	set_bit(BTN_EAST, input->keybit);
+	set_bit(BTN_WEST, input->keybit);
+	set_bit(BTN_NORTH, input->keybit);
+	set_bit(BTN_SELECT, input->keybit);
+	set_bit(BTN_MODE, input->keybit);
+	set_bit(BTN_START, input->keybit);
+	set_bit(BTN_TL, input->keybit);
+	set_bit(BTN_TR, input->keybit);
+	set_bit(BTN_TL2, input->keybit);
+	set_bit(BTN_TR2, input->keybit);
+	set_bit(BTN_C, input->keybit); /* Left grip */
+	set_bit(BTN_Z, input->keybit); /* Right grip */
+	set_bit(BTN_LEFTPAD_CLICK, input->keybit);
+	set_bit(BTN_THUMBR, input->keybit);
+	set_bit(BTN_THUMBL, input->keybit);
+
+	set_bit(EV_ABS, input->evbit);
 	/* Stick */
-	set_bit(ABS_X, sc->input->absbit);
-	set_bit(ABS_Y, sc->input->absbit);
-	input_set_abs_params(sc->input, ABS_X, -32767, 32767, 100, 100);
-	input_set_abs_params(sc->input, ABS_Y, -32767, 32767, 100, 100);
+	set_bit(ABS_X, input->absbit);
+	set_bit(ABS_Y, input->absbit);
+	input_set_abs_params(input, ABS_X, -32767, 32767, 100, 100);
+	input_set_abs_params(input, ABS_Y, -32767, 32767, 100, 100);
 	/* Touchpads */
-	set_bit(ABS_HAT0X, sc->input->absbit);
-	set_bit(ABS_HAT0Y, sc->input->absbit);
-	set_bit(ABS_RX, sc->input->absbit);
-	set_bit(ABS_RY, sc->input->absbit);
-	input_set_abs_params(sc->input, ABS_HAT0X, -32767, 32767, 500, 1000);
-	input_set_abs_params(sc->input, ABS_HAT0Y, -32767, 32767, 500, 1000);
-	input_set_abs_params(sc->input, ABS_RX, -32767, 32767, 500, 1000);
-	input_set_abs_params(sc->input, ABS_RY, -32767, 32767, 500, 1000);
+	set_bit(ABS_HAT0X, input->absbit);
+	set_bit(ABS_HAT0Y, input->absbit);
+	set_bit(ABS_RX, input->absbit);
+	set_bit(ABS_RY, input->absbit);
+	input_set_abs_params(input, ABS_HAT0X, -32767, 32767, 500, 1000);
+	input_set_abs_params(input, ABS_HAT0Y, -32767, 32767, 500, 1000);
+	input_set_abs_params(input, ABS_RX, -32767, 32767, 500, 1000);
+	input_set_abs_params(input, ABS_RY, -32767, 32767, 500, 1000);
 	/* Triggers */
-	set_bit(ABS_HAT2X, sc->input->absbit);
-	set_bit(ABS_HAT2Y, sc->input->absbit);
-	input_set_abs_params(sc->input, ABS_HAT2X, 0, 255, 2, 1);
-	input_set_abs_params(sc->input, ABS_HAT2Y, 0, 255, 2, 1);
+	set_bit(ABS_HAT2X, input->absbit);
+	set_bit(ABS_HAT2Y, input->absbit);
+	input_set_abs_params(input, ABS_HAT2X, 0, 255, 2, 1);
+	input_set_abs_params(input, ABS_HAT2Y, 0, 255, 2, 1);
 
 	/* emulate rumble using touchpad haptics */
-	set_bit(FF_RUMBLE, sc->input->ffbit);
-	ret = input_ff_create_memless(sc->input, NULL, valve_sc_play_effect);
+	set_bit(FF_RUMBLE, input->ffbit);
+	ret = input_ff_create_memless(input, NULL, valve_sc_play_effect);
 	if (ret != 0) {
 		hid_err(hdev, "Failed to create ff memless: %d.\n", -ret);
 		goto error;
 	}
 
-	ret = input_register_device(sc->input);
+	ret = input_register_device(input);
 	if (ret != 0) {
 		hid_err(hdev, "Failed to register input device: %d.\n", -ret);
 		goto error;
 	}
 
+	rcu_assign_pointer(sc->input, input);
 	return 0;
 error:
-	input_free_device(sc->input);
-	sc->input = NULL;
+	input_free_device(input);
 	return ret;
 }
 
@@ -570,8 +979,13 @@ static int valve_sc_update_orientation_setting(struct valve_sc_device *sc)
 
 static int valve_sc_open_sensor(struct input_dev *dev)
 {
+	int ret;
 	struct valve_sc_device *sc = input_get_drvdata(dev);
 
+	ret = valve_sc_hw_open(sc);
+	if (ret != 0)
+		return ret;
+
 	sc->orientation |= SC_SETTINGS_ORIENTATION_ACCEL |
 			   SC_SETTINGS_ORIENTATION_GYRO;
 	valve_sc_update_orientation_setting(sc);
@@ -585,92 +999,197 @@ static void valve_sc_close_sensor(struct input_dev *dev)
 	sc->orientation &= ~SC_SETTINGS_ORIENTATION_ACCEL &
 			   ~SC_SETTINGS_ORIENTATION_GYRO;
 	valve_sc_update_orientation_setting(sc);
+
+	valve_sc_hw_close(sc);
 }
 
 static int valve_sc_init_sensor(struct valve_sc_device *sc)
 {
 	int ret;
 	struct hid_device *hdev = sc->hdev;
+	struct input_dev *sensor;
 
-	sc->sensor = input_allocate_device();
-	if (!sc->sensor) {
+	sensor = input_allocate_device();
+	if (!sensor) {
 		hid_err(hdev, "Failed to allocate input device for sensors.\n");
 		return -ENOMEM;
 	}
 
-	input_set_drvdata(sc->sensor, sc);
-	sc->sensor->dev.parent = &hdev->dev;
-	sc->sensor->open = valve_sc_open_sensor;
-	sc->sensor->close = valve_sc_close_sensor;
-	sc->sensor->id.bustype = hdev->bus;
-	sc->sensor->id.vendor = hdev->vendor;
-	sc->sensor->id.product = hdev->product;
-	sc->sensor->id.version = hdev->version;
-	sc->sensor->name = CONTROLLER_NAME SENSOR_SUFFIX;
+	input_set_drvdata(sensor, sc);
+	sensor->dev.parent = &hdev->dev;
+	sensor->open = valve_sc_open_sensor;
+	sensor->close = valve_sc_close_sensor;
+	sensor->id.bustype = hdev->bus;
+	sensor->id.vendor = hdev->vendor;
+	sensor->id.product = hdev->product;
+	sensor->id.version = hdev->version;
+	sensor->name = CONTROLLER_NAME SENSOR_SUFFIX;
 	if (sc->uniq)
-		sc->sensor->uniq = sc->uniq;
-
-	set_bit(EV_ABS, sc->sensor->evbit);
-	set_bit(ABS_X, sc->sensor->absbit);
-	set_bit(ABS_Y, sc->sensor->absbit);
-	set_bit(ABS_Z, sc->sensor->absbit);
-	input_set_abs_params(sc->sensor, ABS_X, -32767, 32767, 0, 0);
-	input_set_abs_params(sc->sensor, ABS_Y, -32767, 32767, 0, 0);
-	input_set_abs_params(sc->sensor, ABS_Z, -32767, 32767, 0, 0);
-	input_abs_set_res(sc->sensor, ABS_X, SC_ACCEL_RES_PER_G);
-	input_abs_set_res(sc->sensor, ABS_Y, SC_ACCEL_RES_PER_G);
-	input_abs_set_res(sc->sensor, ABS_Z, SC_ACCEL_RES_PER_G);
-	set_bit(ABS_RX, sc->sensor->absbit);
-	set_bit(ABS_RY, sc->sensor->absbit);
-	set_bit(ABS_RZ, sc->sensor->absbit);
-	input_set_abs_params(sc->sensor, ABS_RX, -32767, 32767, 0, 0);
-	input_set_abs_params(sc->sensor, ABS_RY, -32767, 32767, 0, 0);
-	input_set_abs_params(sc->sensor, ABS_RZ, -32767, 32767, 0, 0);
+		sensor->uniq = sc->uniq;
+
+	set_bit(EV_ABS, sensor->evbit);
+	set_bit(ABS_X, sensor->absbit);
+	set_bit(ABS_Y, sensor->absbit);
+	set_bit(ABS_Z, sensor->absbit);
+	input_set_abs_params(sensor, ABS_X, -32767, 32767, 0, 0);
+	input_set_abs_params(sensor, ABS_Y, -32767, 32767, 0, 0);
+	input_set_abs_params(sensor, ABS_Z, -32767, 32767, 0, 0);
+	input_abs_set_res(sensor, ABS_X, SC_ACCEL_RES_PER_G);
+	input_abs_set_res(sensor, ABS_Y, SC_ACCEL_RES_PER_G);
+	input_abs_set_res(sensor, ABS_Z, SC_ACCEL_RES_PER_G);
+	set_bit(ABS_RX, sensor->absbit);
+	set_bit(ABS_RY, sensor->absbit);
+	set_bit(ABS_RZ, sensor->absbit);
+	input_set_abs_params(sensor, ABS_RX, -32767, 32767, 0, 0);
+	input_set_abs_params(sensor, ABS_RY, -32767, 32767, 0, 0);
+	input_set_abs_params(sensor, ABS_RZ, -32767, 32767, 0, 0);
 	/* TODO: gyroscope resolution */
-	set_bit(INPUT_PROP_ACCELEROMETER, sc->sensor->propbit);
+	set_bit(INPUT_PROP_ACCELEROMETER, sensor->propbit);
 
-	ret = input_register_device(sc->sensor);
+	ret = input_register_device(sensor);
 	if (ret != 0) {
 		hid_err(hdev, "Failed to register sensors input device: %d.\n", -ret);
-		input_free_device(sc->sensor);
-		sc->sensor = NULL;
+		input_free_device(sensor);
 		return ret;
 	}
 
+	rcu_assign_pointer(sc->sensor, sensor);
 	return 0;
 }
 
-static int valve_sc_init_device(struct valve_sc_device *sc)
+static void valve_sc_report_neutral(struct input_dev *input)
+{
+	unsigned int code;
+
+	for_each_set_bit(code, input->keybit, KEY_CNT)
+		input_report_key(input, code, 0);
+	for_each_set_bit(code, input->absbit, ABS_CNT)
+		input_report_abs(input, code, 0);
+	input_sync(input);
+}
+
+static void valve_sc_report_neutral_all(struct valve_sc_device *sc)
+{
+	struct input_dev *input;
+
+	rcu_read_lock();
+	input = rcu_dereference(sc->input);
+	if (input)
+		valve_sc_report_neutral(input);
+	input = rcu_dereference(sc->sensor);
+	if (input)
+		valve_sc_report_neutral(input);
+	rcu_read_unlock();
+}
+
+/* Controllers connected both wired and through a receiver, by serial */
+static LIST_HEAD(valve_sc_registry);
+static DEFINE_MUTEX(valve_sc_registry_lock);
+
+/* Only one path reports the events of a controller, wired is preferred */
+static void valve_sc_registry_update(const char *serial)
+{
+	struct valve_sc_device *sc;
+	bool wired = false;
+	bool muted;
+
+	list_for_each_entry(sc, &valve_sc_registry, registry) {
+		if (sc->wired && strcmp(sc->uniq, serial) == 0)
+			wired = true;
+	}
+
+	list_for_each_entry(sc, &valve_sc_registry, registry) {
+		if (strcmp(sc->uniq, serial) != 0)
+			continue;
+		muted = wired && !sc->wired;
+		if (muted == sc->muted)
+			continue;
+
+		WRITE_ONCE(sc->muted, muted);
+		if (muted) {
+			hid_info(sc->hdev, "Controller %s is also wired, muting.\n",
+				 serial);
+			valve_sc_report_neutral_all(sc);
+		} else {
+			hid_info(sc->hdev, "Unmuting controller %s.\n", serial);
+		}
+	}
+}
+
+static void valve_sc_registry_add(struct valve_sc_device *sc)
+{
+	if (!sc->uniq || sc->uniq[0] == '\0')
+		return;
+
+	mutex_lock(&valve_sc_registry_lock);
+	/* Still registered when the input devices outlived a disconnection */
+	if (list_empty(&sc->registry)) {
+		list_add(&sc->registry, &valve_sc_registry);
+		valve_sc_registry_update(sc->uniq);
+	}
+	mutex_unlock(&valve_sc_registry_lock);
+}
+
+static void valve_sc_registry_del(struct valve_sc_device *sc)
+{
+	if (list_empty(&sc->registry))
+		return;
+
+	mutex_lock(&valve_sc_registry_lock);
+	list_del_init(&sc->registry);
+	WRITE_ONCE(sc->muted, false);
+	valve_sc_registry_update(sc->uniq);
+	mutex_unlock(&valve_sc_registry_lock);
+}
+
+static void valve_sc_stop_device(struct valve_sc_device *sc)
+{
+	struct input_dev *input = valve_sc_owned(sc->input);
+	struct input_dev *sensor = valve_sc_owned(sc->sensor);
+
+	valve_sc_registry_del(sc);
+
+	/* Wait for the frame path to be done with them before unregistering */
+	if (input || sensor) {
+		RCU_INIT_POINTER(sc->input, NULL);
+		RCU_INIT_POINTER(sc->sensor, NULL);
+		synchronize_rcu();
+	}
+
+	if (input)
+		input_unregister_device(input);
+	if (sensor)
+		input_unregister_device(sensor);
+	kfree(sc->uniq);
+	sc->uniq = NULL;
+}
+
+/* Returns the controller serial stored in serial[1..], empty on error */
+static const char *valve_sc_read_serial(struct valve_sc_device *sc,
+					u8 serial[64])
 {
 	int ret;
-	struct hid_device *hdev = sc->hdev;
-	u8 params[6];
-	u8 feature;
-	u8 serial[64];
 	int serial_len;
 
-	hid_info(hdev, "Initializing device.\n");
-
-	/* Retrieve controller serial */
 	serial[0] = 1;
 	ret = valve_sc_send_request(sc, SC_FEATURE_GET_SERIAL,
 				    serial, 21,
 				    serial, &serial_len);
 	if (ret < 0 || serial_len < 1 || serial_len > 62) {
-		hid_warn(hdev, "Error while get controller serial: %d\n", -ret);
+		hid_warn(sc->hdev, "Error while get controller serial: %d\n", -ret);
 		serial_len = 1;
-		serial[1] = '\0';
-	} else {
-		serial[serial_len] = '\0';
 	}
+	serial[serial_len] = '\0';
 
-	sc->uniq = kmalloc(serial_len, GFP_KERNEL);
-	if (!sc->uniq) {
-		hid_warn(hdev, "Failed to allocate memory for uniq.\n");
-	} else {
-		strncpy(sc->uniq, &serial[1], serial_len-1);
-		sc->uniq[serial_len-1] = '\0';
-	}
+	return &serial[1];
+}
+
+static void valve_sc_configure(struct valve_sc_device *sc)
+{
+	int ret;
+	struct hid_device *hdev = sc->hdev;
+	u8 params[6];
+	u8 feature;
 
 	/* Set mouse mode for right pad */
 	params[0] = SC_SETTINGS_AUTOMOUSE;
@@ -699,95 +1218,410 @@ static int valve_sc_init_device(struct valve_sc_device *sc)
 				    NULL, NULL);
 	if (ret < 0)
 		hid_warn(hdev, "Error while setting auto buttons: %d\n", -ret);
+}
+
+/* Keeps the input devices of the same controller, or replaces them */
+static void valve_sc_apply_serial(struct valve_sc_device *sc, const char *uniq)
+{
+	int ret;
+	struct hid_device *hdev = sc->hdev;
+
+	/* Input devices are kept while the same controller reconnects */
+	if (valve_sc_owned(sc->input) || valve_sc_owned(sc->sensor)) {
+		if (uniq[0] == '\0' || (sc->uniq && strcmp(sc->uniq, uniq) == 0))
+			return;
+		hid_info(hdev, "New controller %s.\n", uniq);
+		valve_sc_stop_device(sc);
+	}
+
+	sc->uniq = kstrdup(uniq, GFP_KERNEL);
+	if (!sc->uniq)
+		hid_warn(hdev, "Failed to allocate memory for uniq.\n");
 
 	ret = valve_sc_init_input(sc);
 	if (ret < 0)
 		hid_warn(hdev, "Failed to initialize input device: %d\n", -ret);
 
-	ret = valve_sc_init_sensor(sc);
-	if (ret < 0)
-		hid_warn(hdev, "Failed to initialize sensors input device: %d\n", -ret);
+	if (sc->sensor_enabled) {
+		ret = valve_sc_init_sensor(sc);
+		if (ret < 0)
+			hid_warn(hdev, "Failed to initialize sensors input device: %d\n", -ret);
+	}
+
+	valve_sc_registry_add(sc);
+}
+
+static int valve_sc_init_device(struct valve_sc_device *sc)
+{
+	u8 serial[64];
+	const char *uniq;
+
+	hid_info(sc->hdev, "Initializing device.\n");
+
+	/* The slot most likely reconnects the same controller: restore the
+	 * settings so that events flow through the existing input devices
+	 * right away, and check the serial afterwards, since another
+	 * controller paired earlier may have woken up into the slot.
+	 */
+	if ((valve_sc_owned(sc->input) || valve_sc_owned(sc->sensor)) &&
+	    sc->uniq && sc->uniq[0] != '\0' && !sc->serial_stale) {
+		valve_sc_configure(sc);
+		queue_work(sc->lifecycle_wq, &sc->serial_work);
+		return 0;
+	}
+
+	uniq = valve_sc_read_serial(sc, serial);
+	valve_sc_configure(sc);
+	sc->serial_stale = false;
+	valve_sc_apply_serial(sc, uniq);
 
 	return 0;
 }
 
-static void valve_sc_connect_work(struct work_struct *work)
+/* Runs after the connection work, on the same ordered workqueue */
+static void valve_sc_serial_work(struct work_struct *work)
 {
 	struct valve_sc_device *sc = container_of(work, struct valve_sc_device,
-						     connect_work);
-	valve_sc_init_device(sc);
+						  serial_work);
+	u8 serial[64];
+
+	if (!sc->link_up)
+		return;
+	valve_sc_apply_serial(sc, valve_sc_read_serial(sc, serial));
 }
 
-static void valve_sc_stop_device(struct valve_sc_device *sc)
+static void valve_sc_sensor_work(struct work_struct *work)
 {
-	if (sc->input) {
-		input_unregister_device(sc->input);
-		input_free_device(sc->input);
-		sc->input = NULL;
+	struct valve_sc_device *sc = container_of(work, struct valve_sc_device,
+						  sensor_work);
+	struct input_dev *sensor = valve_sc_owned(sc->sensor);
+	int ret;
+
+	if (sc->sensor_enabled && valve_sc_owned(sc->input) && !sensor) {
+		ret = valve_sc_init_sensor(sc);
+		if (ret < 0)
+			hid_warn(sc->hdev, "Failed to initialize sensors input device: %d\n", -ret);
+	} else if (!sc->sensor_enabled && sensor) {
+		/* Frames may still be reporting to it */
+		RCU_INIT_POINTER(sc->sensor, NULL);
+		synchronize_rcu();
+		input_unregister_device(sensor);
 	}
-	if (sc->sensor) {
-		input_unregister_device(sc->sensor);
-		input_free_device(sc->sensor);
-		sc->sensor = NULL;
+}
+
+static void valve_sc_link_work(struct work_struct *work)
+{
+	struct valve_sc_device *sc = container_of(to_delayed_work(work),
+						  struct valve_sc_device,
+						  link_work);
+	bool connected = READ_ONCE(sc->connected);
+	ktime_t start = ktime_get();
+
+	valve_sc_work_started(&sc->lifecycle_latency);
+
+	/* A flap: the events during the hold-off cancelled each other and
+	 * the link is back to its state, nothing to reinitialize.
+	 */
+	if (connected == sc->link_up) {
+		atomic_inc(&sc->link_flaps);
+		return;
 	}
-	kfree(sc->uniq);
-	sc->uniq = NULL;
+	sc->link_up = connected;
+
+	if (connected) {
+		valve_sc_init_device(sc);
+	} else {
+		/* Keep the input devices for the next connection of the same
+		 * controller, only release anything that is still held.
+		 */
+		sc->feedback_buttons = 0;
+		valve_sc_report_neutral_all(sc);
+	}
+
+	trace_valve_sc_link(sc->hdev, connected,
+			    ktime_to_ns(ktime_sub(ktime_get(), start)));
 }
 
-static void valve_sc_disconnect_work(struct work_struct *work)
+static void valve_sc_link_changed(struct valve_sc_device *sc)
 {
-	struct valve_sc_device *sc = container_of(work, struct valve_sc_device,
-						     disconnect_work);
-	valve_sc_stop_device(sc);
+	unsigned long delay = msecs_to_jiffies(connect_holdoff);
+
+	sc->lifecycle_latency.queued = ktime_add_ms(ktime_get(),
+						    connect_holdoff);
+	/* A pending change is merged with this one, the work counts the flap */
+	mod_delayed_work(sc->lifecycle_wq, &sc->link_work, delay);
 }
 
-static int valve_sc_raw_event(struct hid_device *hdev,
-			      struct hid_report *report, u8 *raw_data, int size)
+static void valve_sc_capture_frame(struct valve_sc_capture *capture,
+				   const u8 *raw_data)
 {
-	struct valve_sc_device *sc = hid_get_drvdata(hdev);
+	struct valve_sc_capture_record *record;
+	unsigned long flags;
+
+	spin_lock_irqsave(&capture->lock, flags);
+	record = &capture->records[capture->head];
+	record->timestamp = cpu_to_le64(ktime_get_ns());
+	memcpy(record->data, raw_data, sizeof(record->data));
+	capture->head = (capture->head + 1) % capture->size;
+	if (capture->count < capture->size)
+		++capture->count;
+	++capture->written;
+	spin_unlock_irqrestore(&capture->lock, flags);
+}
 
-	if (sc->parse_raw_report && size == 64) {
-		switch (raw_data[SC_OFFSET_TYPE]) {
-		case 0x01: /* Input events */
-			if (raw_data[SC_OFFSET_LENGTH] != 60)
-				hid_warn(hdev, "Wrong input event length.\n");
-			if (sc->input || sc->sensor)
-				valve_sc_parse_input_events(sc, raw_data);
+/* Handles a 64-byte report from the device, or injected from debugfs (those
+ * are only counted as injected). Called with frame_lock held.
+ */
+static void valve_sc_handle_frame(struct valve_sc_device *sc,
+				  const u8 *raw_data, bool injected)
+{
+	struct input_dev *input, *sensor;
+
+	/* Remove waits for the frames already past this check */
+	rcu_read_lock();
+	if (READ_ONCE(sc->removing)) {
+		rcu_read_unlock();
+		return;
+	}
+
+	switch (raw_data[SC_OFFSET_TYPE]) {
+	case 0x01: /* Input events */
+		if (!injected)
+			valve_sc_stat_inc(sc, frames_input);
+		if (raw_data[SC_OFFSET_LENGTH] != 60) {
+			valve_sc_stat_inc(sc, bad_length);
+			dev_warn_ratelimited(&sc->hdev->dev,
+					     "Wrong input event length.\n");
+		}
+		if (sc->first_event_pending) {
+			s64 latency = ktime_to_ns(ktime_sub(ktime_get(),
+							    sc->connect_stamp));
+
+			sc->first_event_pending = false;
+			sc->reconnect_latency_last = latency;
+			if (latency > sc->reconnect_latency_max)
+				sc->reconnect_latency_max = latency;
+		}
+		input = rcu_dereference(sc->input);
+		sensor = rcu_dereference(sc->sensor);
+		if ((input || sensor) && !READ_ONCE(sc->muted))
+			valve_sc_parse_input_events(sc, input, sensor, raw_data);
+		else
+			valve_sc_stat_inc(sc, decode_skipped);
+		break;
+
+	case 0x03: /* Connection events */
+		if (!injected)
+			valve_sc_stat_inc(sc, frames_connection);
+		if (raw_data[SC_OFFSET_LENGTH] != 1) {
+			valve_sc_stat_inc(sc, bad_length);
+			dev_warn_ratelimited(&sc->hdev->dev,
+					     "Wrong connection event length.\n");
+		}
+		switch (raw_data[4]) {
+		case 0x01: /* Disconnected device */
+			hid_dbg(sc->hdev, "Disconnected event\n");
+			if (sc->connected) {
+				sc->connected = false;
+				valve_sc_link_changed(sc);
+			}
 			break;
 
-		case 0x03: /* Connection events */
-			if (raw_data[SC_OFFSET_LENGTH] != 1)
-				hid_warn(hdev, "Wrong connection event length.\n");
-			switch (raw_data[4]) {
-			case 0x01: /* Disconnected device */
-				hid_dbg(hdev, "Disconnected event\n");
-				if (sc->connected) {
-					sc->connected = false;
-					schedule_work(&sc->disconnect_work);
-				}
-				break;
-
-			case 0x02: /* Connected device */
-				hid_dbg(hdev, "Connected event\n");
-				if (!sc->connected) {
-					sc->connected = true;
-					schedule_work(&sc->connect_work);
-				}
-				break;
-
-			case 0x03: /* Paired device*/
-			default:
-				break;
+		case 0x02: /* Connected device */
+			hid_dbg(sc->hdev, "Connected event\n");
+			if (!sc->connected) {
+				sc->connected = true;
+				sc->connect_stamp = ktime_get();
+				sc->first_event_pending = true;
+				valve_sc_link_changed(sc);
 			}
 			break;
 
+		case 0x03: /* Paired device*/
+			hid_dbg(sc->hdev, "Paired event\n");
+			/* Another controller may use this slot now */
+			sc->serial_stale = true;
+			break;
+
 		default:
 			break;
 		}
+		break;
+
+	default:
+		if (!injected)
+			valve_sc_stat_inc(sc, frames_unknown);
+		break;
+	}
+	rcu_read_unlock();
+}
+
+static int valve_sc_raw_event(struct hid_device *hdev,
+			      struct hid_report *report, u8 *raw_data, int size)
+{
+	struct valve_sc_device *sc = hid_get_drvdata(hdev);
+	/* Only time the decoding when it is traced */
+	bool traced = trace_valve_sc_frame_enabled();
+	ktime_t start = 0;
+	unsigned long flags;
+
+	if (traced)
+		start = ktime_get();
+
+	if (sc->parse_raw_report && size != 64)
+		valve_sc_stat_inc(sc, wrong_size);
+
+	if (sc->capture && size == 64)
+		valve_sc_capture_frame(sc->capture, raw_data);
+
+	if (sc->parse_raw_report && size == 64) {
+		spin_lock_irqsave(&sc->frame_lock, flags);
+		valve_sc_handle_frame(sc, raw_data, false);
+		spin_unlock_irqrestore(&sc->frame_lock, flags);
+
+		if (traced)
+			trace_valve_sc_frame(hdev, raw_data[SC_OFFSET_TYPE],
+					     raw_data[SC_OFFSET_SEQNUM] |
+					     raw_data[SC_OFFSET_SEQNUM+1] << 8,
+					     ktime_to_ns(ktime_sub(ktime_get(), start)));
+	}
+	return 0;
+}
+
+/* Snapshot of the capture ring, oldest frame first */
+struct valve_sc_capture_dump {
+	size_t len;
+	struct valve_sc_capture_record records[];
+};
+
+static int valve_sc_capture_open(struct inode *inode, struct file *file)
+{
+	struct valve_sc_device *sc = inode->i_private;
+	struct valve_sc_capture *capture = sc->capture;
+	struct valve_sc_capture_dump *dump;
+	unsigned int pos, chunk, count = 0;
+	unsigned long seq, end, flags;
+
+	dump = vmalloc(struct_size(dump, records, capture->size));
+	if (!dump)
+		return -ENOMEM;
+
+	spin_lock_irqsave(&capture->lock, flags);
+	end = capture->written;
+	seq = end - capture->count;
+	spin_unlock_irqrestore(&capture->lock, flags);
+
+	/* Copy the frames up to end by chunks, skipping those overwritten
+	 * between two chunks.
+	 */
+	while ((long)(end - seq) > 0) {
+		spin_lock_irqsave(&capture->lock, flags);
+		if (capture->written - seq > capture->size)
+			seq = capture->written - capture->size;
+		pos = (capture->head + capture->size -
+		       (capture->written - seq)) % capture->size;
+		for (chunk = 0; chunk < SC_CAPTURE_CHUNK &&
+		     (long)(end - seq) > 0; ++chunk, ++seq) {
+			dump->records[count++] = capture->records[pos];
+			pos = (pos + 1) % capture->size;
+		}
+		spin_unlock_irqrestore(&capture->lock, flags);
+		cond_resched();
 	}
+	dump->len = count * sizeof(struct valve_sc_capture_record);
+
+	file->private_data = dump;
+	return 0;
+}
+
+static ssize_t valve_sc_capture_read(struct file *file, char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+	struct valve_sc_capture_dump *dump = file->private_data;
+
+	return simple_read_from_buffer(buf, count, ppos,
+				       dump->records, dump->len);
+}
+
+static int valve_sc_capture_release(struct inode *inode, struct file *file)
+{
+	vfree(file->private_data);
 	return 0;
 }
 
+static const struct file_operations valve_sc_capture_fops = {
+	.owner = THIS_MODULE,
+	.open = valve_sc_capture_open,
+	.read = valve_sc_capture_read,
+	.release = valve_sc_capture_release,
+	.llseek = default_llseek,
+};
+
+/* Feed raw frames written by userspace through valve_sc_raw_event */
+static ssize_t valve_sc_inject_write(struct file *file,
+				     const char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+	struct valve_sc_device *sc = file->private_data;
+	u8 frame[64];
+	size_t done;
+	ktime_t next = ktime_get();
+	ktime_t now;
+	u32 rate = READ_ONCE(sc->inject_rate);
+	unsigned long flags;
+
+	if (count % sizeof(frame) != 0)
+		return -EINVAL;
+
+	for (done = 0; done < count; done += sizeof(frame)) {
+		if (signal_pending(current))
+			return done ? done : -EINTR;
+
+		if (copy_from_user(frame, buf + done, sizeof(frame)))
+			return done ? done : -EFAULT;
+
+		/* Pace the frames at the requested rate, if any */
+		if (rate) {
+			now = ktime_get();
+			if (ktime_before(now, next))
+				usleep_range(ktime_us_delta(next, now),
+					     ktime_us_delta(next, now) + 50);
+			next = ktime_add_ns(next, NSEC_PER_SEC / rate);
+		}
+
+		valve_sc_stat_inc(sc, injected);
+		if (sc->capture)
+			valve_sc_capture_frame(sc->capture, frame);
+		/* Serialized with the reports from the device */
+		spin_lock_irqsave(&sc->frame_lock, flags);
+		valve_sc_handle_frame(sc, frame, true);
+		spin_unlock_irqrestore(&sc->frame_lock, flags);
+	}
+
+	return count;
+}
+
+static const struct file_operations valve_sc_inject_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = valve_sc_inject_write,
+	.llseek = noop_llseek,
+};
+
+static struct dentry *valve_sc_debugfs_root;
+
+static void valve_sc_init_debugfs(struct valve_sc_device *sc)
+{
+	sc->debugfs = debugfs_create_dir(dev_name(&sc->hdev->dev),
+					 valve_sc_debugfs_root);
+	if (sc->capture)
+		debugfs_create_file("capture", 0400, sc->debugfs, sc,
+				    &valve_sc_capture_fops);
+	debugfs_create_file("inject", 0200, sc->debugfs, sc,
+			    &valve_sc_inject_fops);
+	debugfs_create_u32("inject_rate", 0600, sc->debugfs, &sc->inject_rate);
+}
+
 static int valve_sc_init_wireless(struct valve_sc_device *sc)
 {
 	int ret;
@@ -812,6 +1646,7 @@ static int valve_sc_init_wireless(struct valve_sc_device *sc)
 		return 0;
 	case 0x02: /* device is connected */
 		sc->connected = true;
+		sc->link_up = true;
 		valve_sc_init_device(sc);
 		return 0;
 	default:
@@ -820,11 +1655,57 @@ static int valve_sc_init_wireless(struct valve_sc_device *sc)
 	}
 }
 
+/* Time at which matching devices were added to the HID bus */
+struct valve_sc_hotplug {
+	struct list_head list;
+	struct device *dev;
+	ktime_t stamp;
+};
+
+static LIST_HEAD(valve_sc_hotplug_list);
+static DEFINE_SPINLOCK(valve_sc_hotplug_lock);
+
+static void valve_sc_hotplug_add(struct device *dev)
+{
+	struct valve_sc_hotplug *hotplug;
+
+	hotplug = kmalloc(sizeof(*hotplug), GFP_KERNEL);
+	if (!hotplug)
+		return;
+	hotplug->dev = dev;
+	hotplug->stamp = ktime_get();
+
+	spin_lock(&valve_sc_hotplug_lock);
+	list_add(&hotplug->list, &valve_sc_hotplug_list);
+	spin_unlock(&valve_sc_hotplug_lock);
+}
+
+/* Returns and forgets the time the device was added, 0 if unknown */
+static ktime_t valve_sc_hotplug_take(struct device *dev)
+{
+	struct valve_sc_hotplug *hotplug, *tmp;
+	ktime_t stamp = 0;
+
+	spin_lock(&valve_sc_hotplug_lock);
+	list_for_each_entry_safe(hotplug, tmp, &valve_sc_hotplug_list, list) {
+		if (hotplug->dev == dev) {
+			stamp = hotplug->stamp;
+			list_del(&hotplug->list);
+			kfree(hotplug);
+			break;
+		}
+	}
+	spin_unlock(&valve_sc_hotplug_lock);
+
+	return stamp;
+}
+
 static int valve_sc_probe(struct hid_device *hdev,
 			  const struct hid_device_id *id)
 {
 	int ret;
 	struct valve_sc_device *sc;
+	ktime_t hotplug_stamp = valve_sc_hotplug_take(&hdev->dev);
 
 	sc = devm_kzalloc(&hdev->dev, sizeof(struct valve_sc_device),
 			  GFP_KERNEL);
@@ -837,10 +1718,16 @@ static int valve_sc_probe(struct hid_device *hdev,
 	sc->autobuttons = false;
 	sc->orientation = 0;
 	sc->center_touchpads = true;
+	sc->sensor_enabled = !lazy_sensor;
 
-	INIT_WORK(&sc->connect_work, valve_sc_connect_work);
-	INIT_WORK(&sc->disconnect_work, valve_sc_disconnect_work);
+	INIT_LIST_HEAD(&sc->registry);
+	INIT_DELAYED_WORK(&sc->link_work, valve_sc_link_work);
+	INIT_WORK(&sc->sensor_work, valve_sc_sensor_work);
+	INIT_WORK(&sc->serial_work, valve_sc_serial_work);
 	INIT_WORK(&sc->haptic_work, valve_sc_haptic_work);
+	INIT_WORK(&sc->feedback_work, valve_sc_feedback_work);
+	mutex_init(&sc->haptic_lock);
+	spin_lock_init(&sc->frame_lock);
 
 	ret = hid_parse(hdev);
 	if (ret != 0) {
@@ -852,22 +1739,68 @@ static int valve_sc_probe(struct hid_device *hdev,
 	    strncmp(hdev->rdesc, raw_report_desc, RAW_REPORT_DESC_SIZE) == 0) {
 		sc->parse_raw_report = true;
 
+		/* Connection events must be handled in order */
+		sc->lifecycle_wq = alloc_ordered_workqueue("valve-sc-%s", 0,
+							   dev_name(&hdev->dev));
+		if (!sc->lifecycle_wq) {
+			hid_err(hdev, "Failed to allocate workqueue\n");
+			return -ENOMEM;
+		}
+
+		sc->stats = devm_alloc_percpu(&hdev->dev, struct valve_sc_stats);
+		if (!sc->stats) {
+			hid_err(hdev, "Failed to allocate statistics\n");
+			ret = -ENOMEM;
+			goto err_wq;
+		}
+
+		if (capture_frames > SC_CAPTURE_MAX_FRAMES) {
+			hid_warn(hdev, "Capture ring of %u frames is too large (max %u), disabled.\n",
+				 capture_frames, SC_CAPTURE_MAX_FRAMES);
+		} else if (capture_frames) {
+			sc->capture = vzalloc(struct_size(sc->capture, records,
+							  capture_frames));
+			if (sc->capture) {
+				spin_lock_init(&sc->capture->lock);
+				sc->capture->size = capture_frames;
+			} else {
+				hid_warn(hdev, "Failed to allocate capture ring.\n");
+			}
+		}
+
 		ret = hid_hw_start(hdev, HID_CONNECT_HIDRAW);
 		if (ret != 0) {
 			hid_err(hdev, "HW start failed\n");
-			return ret;
+			goto err_wq;
 		}
 
-		ret = hid_hw_open(hdev);
-		if (ret != 0) {
-			hid_err(hdev, "HW open failed\n");
-			return ret;
+		/* Receivers must always be opened to get connection events,
+		 * wired controllers are opened with their input devices.
+		 */
+		sc->wired = id->product == USB_DEVICE_ID_STEAM_CONTROLLER;
+		sc->open_on_demand = sc->wired;
+		if (!sc->open_on_demand) {
+			ret = hid_hw_open(hdev);
+			if (ret != 0) {
+				hid_err(hdev, "HW open failed\n");
+				hid_hw_stop(hdev);
+				goto err_wq;
+			}
 		}
 
 		switch (id->product) {
 		case USB_DEVICE_ID_STEAM_CONTROLLER:
+			/* Other transports (uhid) only get hid_hw_power */
+			if (autosuspend && hid_is_usb(hdev)) {
+				struct usb_interface *intf =
+					to_usb_interface(hdev->dev.parent);
+
+				usb_enable_autosuspend(interface_to_usbdev(intf));
+			}
+
 			/* Wired device is always connected */
 			sc->connected = true;
+			sc->link_up = true;
 			valve_sc_init_device(sc);
 			break;
 
@@ -878,12 +1811,35 @@ static int valve_sc_probe(struct hid_device *hdev,
 			break;
 		}
 
-		ret = sysfs_create_group(&hdev->dev.kobj, &valve_sc_attr_group);
+		if (hotplug_stamp)
+			sc->hotplug_latency = ktime_to_ns(ktime_sub(ktime_get(),
+								    hotplug_stamp));
+
+		ret = sysfs_create_groups(&hdev->dev.kobj, valve_sc_attr_groups);
 		if (ret != 0)
 			hid_warn(hdev, "Failed to create sysfs attribute group.\n");
+
+		valve_sc_init_debugfs(sc);
 	} else {
-		/* This is a generic mouse/keyboard interface */
-		ret = hid_hw_start(hdev, HID_CONNECT_DEFAULT);
+		unsigned int connect_mask;
+
+		/* This is a generic mouse/keyboard interface, only used when
+		 * autobuttons or automouse are enabled.
+		 */
+		switch (lizard_interfaces) {
+		case SC_LIZARD_NONE:
+			connect_mask = 0;
+			break;
+		case SC_LIZARD_HIDRAW:
+			connect_mask = HID_CONNECT_HIDRAW;
+			break;
+		case SC_LIZARD_INPUT:
+		default:
+			connect_mask = HID_CONNECT_DEFAULT;
+			break;
+		}
+
+		ret = hid_hw_start(hdev, connect_mask);
 		if (ret != 0) {
 			hid_err(hdev, "HW start failed\n");
 			return ret;
@@ -891,23 +1847,45 @@ static int valve_sc_probe(struct hid_device *hdev,
 	}
 
 	return 0;
+
+err_wq:
+	vfree(sc->capture);
+	destroy_workqueue(sc->lifecycle_wq);
+	return ret;
 }
 
 static void valve_sc_remove(struct hid_device *hdev)
 {
 	struct valve_sc_device *sc = hid_get_drvdata(hdev);
 
-	sysfs_remove_group(&hdev->dev.kobj, &valve_sc_attr_group);
+	/* The lizard mode interfaces have no attributes */
+	if (sc->parse_raw_report)
+		sysfs_remove_groups(&hdev->dev.kobj, valve_sc_attr_groups);
+	debugfs_remove_recursive(sc->debugfs);
 
-	cancel_work_sync(&sc->connect_work);
-	cancel_work_sync(&sc->disconnect_work);
-	cancel_work_sync(&sc->haptic_work);
+	/* Frames keep coming until the hardware is stopped: make them stop
+	 * queueing work before the works are torn down.
+	 */
+	WRITE_ONCE(sc->removing, true);
+	synchronize_rcu();
 
-	if (sc->connected)
-		valve_sc_stop_device(sc);
+	cancel_delayed_work_sync(&sc->link_work);
+	cancel_work_sync(&sc->sensor_work);
+	cancel_work_sync(&sc->serial_work);
+
+	/* No rumble can be played once the input devices are gone */
+	valve_sc_stop_device(sc);
 
-	hid_hw_close(hdev);
+	cancel_work_sync(&sc->haptic_work);
+	cancel_work_sync(&sc->feedback_work);
+	if (sc->lifecycle_wq)
+		destroy_workqueue(sc->lifecycle_wq);
+
+	if (sc->parse_raw_report && !sc->open_on_demand)
+		hid_hw_close(hdev);
 	hid_hw_stop(hdev);
+
+	vfree(sc->capture);
 }
 
 static const struct hid_device_id valve_sc_devices[] = {
@@ -926,7 +1904,118 @@ static struct hid_driver valve_sc_hid_driver = {
 	.remove = valve_sc_remove,
 	.raw_event = valve_sc_raw_event,
 };
-module_hid_driver(valve_sc_hid_driver);
+
+static bool valve_sc_match(struct hid_device *hdev)
+{
+	const struct hid_device_id *id;
+
+	for (id = valve_sc_devices; id->bus; ++id) {
+		if (hdev->bus == id->bus && hdev->vendor == id->vendor &&
+		    hdev->product == id->product)
+			return true;
+	}
+	return false;
+}
+
+static int valve_sc_takeover_dev(struct device *dev, void *data)
+{
+	if (dev->driver && strcmp(dev->driver->name, "hid-generic") == 0 &&
+	    valve_sc_match(to_hid_device(dev))) {
+		dev_info(dev, "Taking over from hid-generic\n");
+		device_release_driver(dev);
+	}
+	return 0;
+}
+
+/* Older kernels let hid-generic bind devices that have a specific driver,
+ * release them and bind them to this driver instead.
+ */
+static void valve_sc_takeover(struct work_struct *work)
+{
+	bus_for_each_dev(&hid_bus_type, NULL, NULL, valve_sc_takeover_dev);
+	if (driver_attach(&valve_sc_hid_driver.driver) != 0)
+		pr_warn("valve-sc: Failed to attach devices\n");
+}
+
+static DECLARE_WORK(valve_sc_takeover_work, valve_sc_takeover);
+
+static int valve_sc_bus_notify(struct notifier_block *nb,
+			       unsigned long action, void *data)
+{
+	struct device *dev = data;
+
+	if (!valve_sc_match(to_hid_device(dev)))
+		return NOTIFY_DONE;
+
+	switch (action) {
+	case BUS_NOTIFY_ADD_DEVICE:
+		valve_sc_hotplug_add(dev);
+		break;
+	case BUS_NOTIFY_BOUND_DRIVER:
+		if (strcmp(dev->driver->name, "hid-generic") == 0)
+			schedule_work(&valve_sc_takeover_work);
+		break;
+	case BUS_NOTIFY_DEL_DEVICE:
+		valve_sc_hotplug_take(dev);
+		break;
+	}
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block valve_sc_bus_nb = {
+	.notifier_call = valve_sc_bus_notify,
+};
+
+static int __init valve_sc_init(void)
+{
+	int ret;
+
+	valve_sc_haptic_wq = alloc_workqueue("valve-sc-haptic", WQ_HIGHPRI, 0);
+	if (!valve_sc_haptic_wq)
+		return -ENOMEM;
+
+	valve_sc_debugfs_root = debugfs_create_dir("valve-sc", NULL);
+
+	ret = bus_register_notifier(&hid_bus_type, &valve_sc_bus_nb);
+	if (ret != 0)
+		goto err_wq;
+
+	ret = hid_register_driver(&valve_sc_hid_driver);
+	if (ret != 0)
+		goto err_notifier;
+
+	/* Claim devices hid-generic got before the module was loaded */
+	schedule_work(&valve_sc_takeover_work);
+	return 0;
+
+err_notifier:
+	bus_unregister_notifier(&hid_bus_type, &valve_sc_bus_nb);
+err_wq:
+	debugfs_remove_recursive(valve_sc_debugfs_root);
+	destroy_workqueue(valve_sc_haptic_wq);
+	return ret;
+}
+
+static void __exit valve_sc_exit(void)
+{
+	struct valve_sc_hotplug *hotplug, *tmp;
+
+	bus_unregister_notifier(&hid_bus_type, &valve_sc_bus_nb);
+	cancel_work_sync(&valve_sc_takeover_work);
+	hid_unregister_driver(&valve_sc_hid_driver);
+	debugfs_remove_recursive(valve_sc_debugfs_root);
+	destroy_workqueue(valve_sc_haptic_wq);
+
+	list_for_each_entry_safe(hotplug, tmp, &valve_sc_hotplug_list, list)
+		kfree(hotplug);
+}
+
+#if IS_ENABLED(CONFIG_KUNIT) && defined(VALVE_SC_KUNIT)
+#include "hid-valve-sc-test.c"
+#endif
+
+module_init(valve_sc_init);
+module_exit(valve_sc_exit);
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Clement Vuchener");
@@ -0,0 +1,225 @@
+/*
+ * Userspace benchmark of the driver input report decoder
+ *
+ * Copyright (c) 2015 Clement Vuchener
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#include "sc-input-shim.h"
+#include "../hid-valve-sc-decode.h"
+
+#include "sc-emu.h"
+#include "sc-trace.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+
+#define SYNTHETIC_FRAMES	4096
+
+enum {
+	COUNTER_INSTRUCTIONS,
+	COUNTER_CYCLES,
+	COUNTER_CACHE_MISSES,
+	COUNTER_COUNT,
+};
+
+static const char *const counter_names[COUNTER_COUNT] = {
+	"instructions", "cycles", "cache-misses",
+};
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options] [TRACE]\n"
+		"  -n COUNT    number of frames to decode (default 10000000)\n"
+		"  -c 0|1      center_touchpads setting (default 1)\n"
+		"\n"
+		"TRACE is a recorded trace or a driver debugfs capture, without\n"
+		"it synthetic frames are used.\n",
+		name);
+}
+
+/* Keeps the input frames of a trace, returns the number of frames */
+static long load_trace(const char *path, uint8_t **frames)
+{
+	struct sc_trace trace;
+	struct sc_trace_record record;
+	long count = 0, size = 0;
+	uint8_t *tmp;
+	int ret;
+
+	ret = sc_trace_open(&trace, path);
+	if (ret < 0)
+		return ret;
+	*frames = NULL;
+	while ((ret = sc_trace_read(&trace, &record)) > 0) {
+		if (record.data[SC_OFFSET_TYPE] != 0x01)
+			continue;
+		if (count == size) {
+			size = size ? 2 * size : 1024;
+			tmp = realloc(*frames, size * SC_FRAME_SIZE);
+			if (!tmp) {
+				ret = -ENOMEM;
+				break;
+			}
+			*frames = tmp;
+		}
+		memcpy(*frames + count * SC_FRAME_SIZE, record.data,
+		       SC_FRAME_SIZE);
+		++count;
+	}
+	sc_trace_close(&trace);
+	if (ret < 0) {
+		free(*frames);
+		*frames = NULL;
+		return ret;
+	}
+	return count;
+}
+
+/* Random movements on every control, with the pads touched half the time */
+static long synthesize(uint8_t **frames)
+{
+	struct sc_emu emu = { .fd = -1 };
+	struct sc_state state;
+	long i;
+	int axis;
+
+	*frames = malloc(SYNTHETIC_FRAMES * SC_FRAME_SIZE);
+	if (!*frames)
+		return -ENOMEM;
+	srand(1);
+	for (i = 0; i < SYNTHETIC_FRAMES; ++i) {
+		memset(&state, 0, sizeof(state));
+		state.buttons = ((uint32_t)rand() << 8) & 0x1ffff00;
+		if (rand() % 2)
+			state.buttons |= SC_BTN_TOUCH_LEFT;
+		if (rand() % 2)
+			state.buttons |= SC_BTN_TOUCH_RIGHT;
+		for (axis = 0; axis < 2; ++axis) {
+			state.left[axis] = rand();
+			state.right[axis] = rand();
+			state.triggers[axis] = rand();
+		}
+		for (axis = 0; axis < 3; ++axis) {
+			state.accel[axis] = rand();
+			state.gyro[axis] = rand();
+		}
+		sc_emu_encode(&emu, &state, *frames + i * SC_FRAME_SIZE);
+	}
+	return SYNTHETIC_FRAMES;
+}
+
+static int open_counter(uint64_t config, int group)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.disabled = group < 0;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+int main(int argc, char *argv[])
+{
+	static const uint64_t configs[COUNTER_COUNT] = {
+		PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_CPU_CYCLES,
+		PERF_COUNT_HW_CACHE_MISSES,
+	};
+	static struct input_dev input, sensor;
+	struct valve_sc_frame frame;
+	int fds[COUNTER_COUNT];
+	uint64_t counters[COUNTER_COUNT];
+	unsigned long total = 10000000, i;
+	bool center_touchpads = true;
+	uint8_t *frames = NULL;
+	long count;
+	uint64_t start, duration;
+	int opt, c;
+
+	while ((opt = getopt(argc, argv, "n:c:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			total = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			center_touchpads = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (!total || argc - optind > 1) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (optind < argc)
+		count = load_trace(argv[optind], &frames);
+	else
+		count = synthesize(&frames);
+	if (count <= 0) {
+		fprintf(stderr, "No input frames: %s\n",
+			count ? strerror(-count) : "empty trace");
+		return EXIT_FAILURE;
+	}
+
+	/* The counters are read as a group led by the instructions one */
+	fds[0] = open_counter(configs[0], -1);
+	for (c = 1; c < COUNTER_COUNT; ++c)
+		fds[c] = fds[0] < 0 ? -1 : open_counter(configs[c], fds[0]);
+	if (fds[0] >= 0) {
+		ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+
+	start = sc_emu_now();
+	for (i = 0; i < total; ++i) {
+		valve_sc_decode_frame(frames + (i % count) * SC_FRAME_SIZE,
+				      &frame);
+		valve_sc_report_input(&input, &frame, center_touchpads);
+		valve_sc_report_sensor(&sensor, &frame);
+	}
+	duration = sc_emu_now() - start;
+
+	if (fds[0] >= 0)
+		ioctl(fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+	printf("frames: %lu (%ld distinct)\n", total, count);
+	printf("frames/s: %.0f\n", total * 1e9 / duration);
+	printf("ns/frame: %.2f\n", (double)duration / total);
+	printf("events/frame: %.2f\n",
+	       (double)(input.events + sensor.events) / total);
+	for (c = 0; c < COUNTER_COUNT; ++c) {
+		if (fds[c] < 0 ||
+		    read(fds[c], &counters[c], sizeof(counters[c])) !=
+		    sizeof(counters[c]))
+			printf("%s/frame: n/a\n", counter_names[c]);
+		else
+			printf("%s/frame: %.2f\n", counter_names[c],
+			       (double)counters[c] / total);
+		if (fds[c] >= 0)
+			close(fds[c]);
+	}
+
+	free(frames);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,372 @@
+/*
+ * Control transfer budget of the driver operations
+ *
+ * Copyright (c) 2015 Clement Vuchener
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#include "sc-emu.h"
+#include "sc-evdev.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_BUDGETS	64
+
+struct budget {
+	char name[32];
+	unsigned long set, get;
+	double ms;
+};
+
+struct operation {
+	struct sc_emu *emu;
+	uint64_t start;
+	unsigned long set, get;
+};
+
+static struct budget budgets[MAX_BUDGETS];
+static int budget_count;
+static unsigned int quiet_ms = 300;
+static double tolerance = 20.0;
+static int failures;
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -b FILE     budget to check the measures against\n"
+		"  -t PERCENT  blocking time tolerance (default 20)\n"
+		"  -q MS       time without requests ending an operation (default 300)\n"
+		"\n"
+		"The measures are printed in the budget format:\n"
+		"  OPERATION SET GET MS\n",
+		name);
+}
+
+static int load_budget(const char *path)
+{
+	FILE *file;
+	char line[128];
+	struct budget *budget;
+
+	file = fopen(path, "r");
+	if (!file)
+		return -errno;
+	while (budget_count < MAX_BUDGETS && fgets(line, sizeof(line), file)) {
+		if (line[0] == '#' || line[strspn(line, " \t\n")] == '\0')
+			continue;
+		budget = &budgets[budget_count];
+		if (sscanf(line, "%31s %lu %lu %lf", budget->name,
+			   &budget->set, &budget->get, &budget->ms) != 4) {
+			fclose(file);
+			return -EINVAL;
+		}
+		++budget_count;
+	}
+	fclose(file);
+	return 0;
+}
+
+/* Handles the requests until none came for quiet_ms */
+static void settle(struct sc_emu *emu, uint64_t start)
+{
+	uint64_t last;
+
+	for (;;) {
+		last = emu->last_request > start ? emu->last_request : start;
+		if (sc_emu_now() >= last + quiet_ms * 1000000ull)
+			break;
+		sc_emu_service(emu, 10);
+	}
+}
+
+static void begin(struct operation *op, struct sc_emu *emu)
+{
+	op->emu = emu;
+	op->set = emu->set_count;
+	op->get = emu->get_count;
+	op->start = sc_emu_now();
+}
+
+/* Prints the requests made since begin and the time blocked until last */
+static void check(struct operation *op, const char *name, uint64_t last)
+{
+	struct sc_emu *emu = op->emu;
+	unsigned long set, get;
+	double ms;
+	int i;
+
+	set = emu->set_count - op->set;
+	get = emu->get_count - op->get;
+	ms = last > op->start ? (last - op->start) / 1e6 : 0.0;
+	printf("%-32s %3lu %3lu %8.1f\n", name, set, get, ms);
+	fflush(stdout);
+
+	for (i = 0; i < budget_count; ++i) {
+		if (strcmp(budgets[i].name, name) != 0)
+			continue;
+		if (set != budgets[i].set || get != budgets[i].get ||
+		    ms > budgets[i].ms * (1.0 + tolerance / 100.0) + 1.0) {
+			fprintf(stderr, "FAIL %s: %lu %lu %.1f, budget %lu %lu %.1f\n",
+				name, set, get, ms, budgets[i].set,
+				budgets[i].get, budgets[i].ms);
+			++failures;
+		}
+		return;
+	}
+}
+
+/* The operation blocks until its last request or its own end */
+static void end(struct operation *op, const char *name, uint64_t done)
+{
+	struct sc_emu *emu = op->emu;
+
+	settle(emu, op->start);
+	check(op, name, emu->last_request > done ? emu->last_request : done);
+}
+
+/* The operation blocks until the settings are restored, the requests
+ * made afterwards (the serial check of a reconnection) are only counted.
+ */
+static void end_settings(struct operation *op, const char *name)
+{
+	struct sc_emu *emu = op->emu;
+
+	settle(emu, op->start);
+	check(op, name, emu->last_settings);
+}
+
+static int wait_evdev(struct sc_emu *emu, bool sensor, int mode)
+{
+	uint64_t deadline = sc_emu_now() + 10000000000ull;
+	int fd;
+
+	while ((fd = sc_evdev_open_mode(emu->serial, sensor, mode)) < 0 &&
+	       sc_emu_now() < deadline)
+		sc_emu_service(emu, 10);
+	return fd;
+}
+
+static void store(struct sc_emu *emu, const char *sysfs,
+		  const char *attr, const char *value)
+{
+	struct operation op;
+	char name[32];
+	int ret;
+
+	snprintf(name, sizeof(name), "store-%s=%s", attr, value);
+	begin(&op, emu);
+	ret = sc_sysfs_write(sysfs, attr, value);
+	if (ret < 0)
+		fprintf(stderr, "Failed to write %s: %s\n", attr,
+			strerror(-ret));
+	end(&op, name, sc_emu_now());
+}
+
+static int rumble(int fd, int16_t id, int value)
+{
+	struct input_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = EV_FF;
+	ev.code = id;
+	ev.value = value;
+	return write(fd, &ev, sizeof(ev)) == sizeof(ev) ? 0 : -errno;
+}
+
+static int run_wired(void)
+{
+	static const char *const stores[][2] = {
+		{ "automouse", "off" }, { "automouse", "on" },
+		{ "autobuttons", "on" }, { "autobuttons", "off" },
+		{ "center_touchpads", "off" }, { "center_touchpads", "on" },
+		{ "sensor", "off" }, { "sensor", "on" },
+		{ "click_feedback_left", "1000" }, { "click_feedback_left", "0" },
+		{ "click_feedback_right", "1000" }, { "click_feedback_right", "0" },
+		{ "work_latency", "0" },
+	};
+	struct sc_emu_config config = {
+		.product = SC_PRODUCT_WIRED,
+		.serial = "BUDGET",
+	};
+	struct sc_emu emu;
+	struct operation op;
+	struct ff_effect effect;
+	char sysfs[300];
+	unsigned int i;
+	int gamepad, sensor, ret;
+
+	ret = sc_emu_create(&emu, &config, 0);
+	if (ret < 0)
+		return ret;
+
+	begin(&op, &emu);
+	gamepad = wait_evdev(&emu, false, O_RDWR);
+	end(&op, "probe-wired", sc_emu_now());
+	if (gamepad < 0) {
+		sc_emu_destroy(&emu);
+		return gamepad;
+	}
+	ret = sc_sysfs_find(emu.index, sysfs, sizeof(sysfs));
+	if (ret < 0)
+		goto out;
+
+	for (i = 0; i < sizeof(stores)/sizeof(stores[0]); ++i)
+		store(&emu, sysfs, stores[i][0], stores[i][1]);
+
+	begin(&op, &emu);
+	sensor = wait_evdev(&emu, true, O_RDONLY);
+	end(&op, "sensor-open", sc_emu_now());
+	if (sensor >= 0) {
+		begin(&op, &emu);
+		close(sensor);
+		end(&op, "sensor-close", sc_emu_now());
+	}
+
+	memset(&effect, 0, sizeof(effect));
+	effect.type = FF_RUMBLE;
+	effect.id = -1;
+	effect.u.rumble.strong_magnitude = 0x8000;
+	effect.u.rumble.weak_magnitude = 0x8000;
+	if (ioctl(gamepad, EVIOCSFF, &effect) < 0) {
+		ret = -errno;
+		goto out;
+	}
+	begin(&op, &emu);
+	rumble(gamepad, effect.id, 1);
+	end(&op, "rumble-start", sc_emu_now());
+	begin(&op, &emu);
+	rumble(gamepad, effect.id, 0);
+	end(&op, "rumble-stop", sc_emu_now());
+	/* Removing the effect stops it again, out of any operation */
+	ioctl(gamepad, EVIOCRMFF, effect.id);
+	settle(&emu, sc_emu_now());
+
+out:
+	begin(&op, &emu);
+	close(gamepad);
+	end(&op, "close-wired", sc_emu_now());
+	sc_emu_destroy(&emu);
+	return ret;
+}
+
+static int run_receiver(void)
+{
+	struct sc_emu_config config = {
+		.product = SC_PRODUCT_RECEIVER,
+		.serial = "BUDGET",
+	};
+	struct sc_emu emu;
+	struct operation op;
+	int gamepad, ret;
+
+	ret = sc_emu_create(&emu, &config, 1);
+	if (ret < 0)
+		return ret;
+
+	/* Receivers are opened at probe */
+	begin(&op, &emu);
+	while (!emu.opened && sc_emu_now() < op.start + 10000000000ull)
+		sc_emu_service(&emu, 10);
+	end(&op, "probe-receiver", sc_emu_now());
+	if (!emu.opened) {
+		sc_emu_destroy(&emu);
+		return -ETIMEDOUT;
+	}
+
+	begin(&op, &emu);
+	sc_emu_send_connection(&emu, SC_CONNECTION_CONNECTED);
+	gamepad = wait_evdev(&emu, false, O_RDONLY);
+	end(&op, "connect", sc_emu_now());
+	if (gamepad >= 0)
+		close(gamepad);
+
+	begin(&op, &emu);
+	sc_emu_send_connection(&emu, SC_CONNECTION_DISCONNECTED);
+	end(&op, "disconnect", sc_emu_now());
+
+	/* Same controller, no pairing: the input devices are kept */
+	begin(&op, &emu);
+	sc_emu_send_connection(&emu, SC_CONNECTION_CONNECTED);
+	end_settings(&op, "reconnect");
+
+	sc_emu_destroy(&emu);
+	return 0;
+}
+
+/* Records how the measures were made, so that the output can be committed
+ * as a baseline.
+ */
+static void print_header(void)
+{
+	static const char *const params[] = { "connect_holdoff", "lazy_sensor" };
+	struct utsname uts;
+	char date[32], value[32];
+	time_t now = time(NULL);
+	unsigned int i;
+
+	strftime(date, sizeof(date), "%Y-%m-%d", gmtime(&now));
+	if (uname(&uts) < 0)
+		strcpy(uts.release, "unknown");
+	printf("# sc-budget on uhid, %s, kernel %s\n#", date, uts.release);
+	for (i = 0; i < sizeof(params)/sizeof(params[0]); ++i) {
+		if (sc_sysfs_read("/sys/module/hid_valve_sc/parameters",
+				  params[i], value, sizeof(value)) <= 0)
+			strcpy(value, "?\n");
+		printf(" %s=%.*s", params[i], (int)strcspn(value, "\n"), value);
+	}
+	printf("\n# operation                     set get       ms\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "b:t:q:h")) != -1) {
+		switch (opt) {
+		case 'b':
+			ret = load_budget(optarg);
+			if (ret < 0) {
+				fprintf(stderr, "Failed to load budget %s: %s\n",
+					optarg, strerror(-ret));
+				return EXIT_FAILURE;
+			}
+			break;
+		case 't':
+			tolerance = atof(optarg);
+			break;
+		case 'q':
+			quiet_ms = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	print_header();
+	ret = run_wired();
+	if (ret == 0)
+		ret = run_receiver();
+	if (ret < 0) {
+		fprintf(stderr, "Failed to run the operations: %s\n",
+			strerror(-ret));
+		return EXIT_FAILURE;
+	}
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
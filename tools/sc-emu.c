@@ -0,0 +1,429 @@
+/*
+ * uhid based Steam Controller emulation
+ *
+ * Copyright (c) 2015 Clement Vuchener
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#include "sc-emu.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/uhid.h>
+
+/* Same descriptor as the vendor interface, see raw_report_desc */
+const uint8_t sc_report_desc[SC_REPORT_DESC_SIZE] = {
+	0x06, 0x00, 0xFF,	/* Usage Page (FF00 - Vendor) */
+	0x09, 0x01,		/* Usage (0001 - Vendor) */
+	0xA1, 0x01,		/* Collection (Application) */
+	0x15, 0x00,		/*  Logical Minimum (0) */
+	0x26, 0xFF, 0x00,	/*  Logical Maximum (255) */
+	0x75, 0x08,		/*  Report Size (8) */
+	0x95, 0x40,		/*  Report Count (64) */
+	0x09, 0x01,		/*  Usage (0001 - Vendor) */
+	0x81, 0x02,		/*  Input (Data, Variable, Absolute) */
+	0x95, 0x40,		/*  Report Count (64) */
+	0x09, 0x01,		/*  Usage (0001 - Vendor) */
+	0x91, 0x02,		/*  Output (Data, Variable, Absolute) */
+	0x95, 0x40,		/*  Report Count (64) */
+	0x09, 0x01,		/*  Usage (0001 - Vendor) */
+	0xB1, 0x02,		/*  Feature (Data, Variable, Absolute) */
+	0xC0,			/* End Collection */
+};
+
+/* Input frame offsets */
+#define SC_OFFSET_TYPE		2
+#define SC_OFFSET_LENGTH	3
+#define SC_OFFSET_SEQNUM	4
+#define SC_OFFSET_BUTTONS	7
+#define SC_OFFSET_TRIGGERS_8	11
+#define SC_OFFSET_LEFT_AXES	16
+#define SC_OFFSET_RIGHT_AXES	20
+#define SC_OFFSET_ACCEL		28
+#define SC_OFFSET_GYRO		34
+
+uint64_t sc_emu_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int sc_emu_parse_faults(struct sc_emu_faults *faults, const char *spec)
+{
+	static const struct {
+		const char *name;
+		size_t offset;
+	} names[] = {
+		{ "delay", offsetof(struct sc_emu_faults, get_delay_ms) },
+		{ "short", offsetof(struct sc_emu_faults, short_every) },
+		{ "wrong_id", offsetof(struct sc_emu_faults, wrong_id_every) },
+		{ "oversize", offsetof(struct sc_emu_faults, oversize_every) },
+		{ "drop", offsetof(struct sc_emu_faults, drop_every) },
+	};
+	const char *end;
+	char *value_end;
+	unsigned long value;
+	size_t len;
+	unsigned int i;
+
+	memset(faults, 0, sizeof(*faults));
+	if (strcmp(spec, "none") == 0)
+		return 0;
+
+	while (*spec) {
+		end = strchr(spec, '=');
+		if (!end)
+			return -EINVAL;
+		len = end - spec;
+		for (i = 0; i < sizeof(names)/sizeof(names[0]); ++i)
+			if (strlen(names[i].name) == len &&
+			    strncmp(names[i].name, spec, len) == 0)
+				break;
+		if (i == sizeof(names)/sizeof(names[0]))
+			return -EINVAL;
+
+		value = strtoul(end + 1, &value_end, 10);
+		if (value_end == end + 1 || (*value_end && *value_end != ','))
+			return -EINVAL;
+		*(unsigned int *)((char *)faults + names[i].offset) = value;
+		spec = *value_end ? value_end + 1 : value_end;
+	}
+	return 0;
+}
+
+static bool sc_emu_fault_due(unsigned int every, unsigned long count)
+{
+	return every && count % every == 0;
+}
+
+static int sc_emu_write(struct sc_emu *emu, const struct uhid_event *ev)
+{
+	ssize_t ret;
+
+	ret = write(emu->fd, ev, sizeof(*ev));
+	if (ret < 0)
+		return -errno;
+	if (ret != sizeof(*ev))
+		return -EIO;
+	return 0;
+}
+
+int sc_emu_create(struct sc_emu *emu, const struct sc_emu_config *config,
+		  int index)
+{
+	struct uhid_event ev;
+	int ret;
+
+	memset(emu, 0, sizeof(*emu));
+	emu->index = index;
+	emu->config = *config;
+	snprintf(emu->serial, sizeof(emu->serial), "%s%02d",
+		 config->serial ? config->serial : "EMU", index);
+	/* A wired controller is always connected */
+	emu->connected = config->product == SC_PRODUCT_WIRED;
+
+	emu->fd = open("/dev/uhid", O_RDWR | O_CLOEXEC);
+	if (emu->fd < 0)
+		return -errno;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_CREATE2;
+	snprintf((char *)ev.u.create2.name, sizeof(ev.u.create2.name),
+		 "Valve Software Steam Controller");
+	snprintf((char *)ev.u.create2.phys, sizeof(ev.u.create2.phys),
+		 "sc-emu/%d", index);
+	memcpy(ev.u.create2.rd_data, sc_report_desc, sizeof(sc_report_desc));
+	ev.u.create2.rd_size = sizeof(sc_report_desc);
+	ev.u.create2.bus = 0x03; /* BUS_USB */
+	ev.u.create2.vendor = SC_VENDOR_ID;
+	ev.u.create2.product = config->product;
+
+	ret = sc_emu_write(emu, &ev);
+	if (ret < 0) {
+		close(emu->fd);
+		emu->fd = -1;
+	}
+	return ret;
+}
+
+void sc_emu_destroy(struct sc_emu *emu)
+{
+	struct uhid_event ev;
+
+	if (emu->fd < 0)
+		return;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_DESTROY;
+	sc_emu_write(emu, &ev);
+	close(emu->fd);
+	emu->fd = -1;
+}
+
+void sc_emu_feature(const struct sc_emu *emu, uint8_t data[SC_FRAME_SIZE])
+{
+	memset(data, 0, SC_FRAME_SIZE);
+	data[0] = emu->feature;
+	switch (emu->feature) {
+	case SC_FEATURE_GET_SERIAL:
+		data[1] = 1 + strlen(emu->serial);
+		data[2] = 0x01;
+		memcpy(&data[3], emu->serial, strlen(emu->serial));
+		break;
+	case SC_FEATURE_GET_CONNECTION_STATE:
+		data[1] = 1;
+		data[2] = emu->connected ? SC_CONNECTION_CONNECTED :
+					   SC_CONNECTION_DISCONNECTED;
+		break;
+	default:
+		data[1] = 0;
+		break;
+	}
+}
+
+static int sc_emu_answer(struct sc_emu *emu, uint32_t type, uint32_t id)
+{
+	const struct sc_emu_faults *faults = &emu->config.faults;
+	struct uhid_event ev;
+
+	emu->last_answer = sc_emu_now();
+	memset(&ev, 0, sizeof(ev));
+	if (type == UHID_SET_REPORT) {
+		ev.type = UHID_SET_REPORT_REPLY;
+		ev.u.set_report_reply.id = id;
+		ev.u.set_report_reply.err = 0;
+		return sc_emu_write(emu, &ev);
+	}
+
+	ev.type = UHID_GET_REPORT_REPLY;
+	ev.u.get_report_reply.id = id;
+	ev.u.get_report_reply.err = 0;
+	ev.u.get_report_reply.size = SC_FEATURE_SIZE;
+	/* data[0] is the report number */
+	sc_emu_feature(emu, &ev.u.get_report_reply.data[1]);
+
+	++emu->get_answers;
+	if (sc_emu_fault_due(faults->short_every, emu->get_answers)) {
+		ev.u.get_report_reply.size = SC_FEATURE_SIZE / 2;
+		++emu->faults_injected;
+	}
+	if (sc_emu_fault_due(faults->wrong_id_every, emu->get_answers)) {
+		ev.u.get_report_reply.data[1] ^= 0x01;
+		++emu->faults_injected;
+	}
+	if (sc_emu_fault_due(faults->oversize_every, emu->get_answers)) {
+		ev.u.get_report_reply.data[2] = SC_FRAME_SIZE - 1;
+		++emu->faults_injected;
+	}
+	return sc_emu_write(emu, &ev);
+}
+
+static int sc_emu_request(struct sc_emu *emu, uint32_t type, uint32_t id)
+{
+	unsigned int delay = emu->config.answer_delay_ms;
+	uint64_t due;
+
+	if (type == UHID_GET_REPORT && emu->config.faults.get_delay_ms) {
+		delay += emu->config.faults.get_delay_ms;
+		++emu->faults_injected;
+	}
+	if (delay == 0)
+		return sc_emu_answer(emu, type, id);
+
+	due = sc_emu_now() + delay * 1000000ull;
+	emu->pending = true;
+	emu->pending_type = type;
+	emu->pending_id = id;
+	emu->pending_due.tv_sec = due / 1000000000ull;
+	emu->pending_due.tv_nsec = due % 1000000000ull;
+	return 0;
+}
+
+int sc_emu_dispatch(struct sc_emu *emu)
+{
+	struct uhid_event ev;
+	ssize_t ret;
+
+	ret = read(emu->fd, &ev, sizeof(ev));
+	if (ret < 0)
+		return -errno;
+
+	switch (ev.type) {
+	case UHID_OPEN:
+		emu->opened = true;
+		break;
+	case UHID_CLOSE:
+		emu->opened = false;
+		break;
+	case UHID_SET_REPORT:
+		++emu->set_count;
+		emu->last_request = sc_emu_now();
+		/* data[0] is the report number */
+		emu->feature = ev.u.set_report.data[1];
+		if (emu->feature == SC_FEATURE_SETTINGS)
+			emu->last_settings = emu->last_request;
+		if (emu->config.verbose)
+			fprintf(stderr, "%s: set feature 0x%02x (%u bytes)\n",
+				emu->serial, emu->feature,
+				ev.u.set_report.data[2]);
+		return sc_emu_request(emu, UHID_SET_REPORT,
+				      ev.u.set_report.id);
+	case UHID_GET_REPORT:
+		++emu->get_count;
+		emu->last_request = sc_emu_now();
+		if (emu->config.verbose)
+			fprintf(stderr, "%s: get feature 0x%02x\n",
+				emu->serial, emu->feature);
+		return sc_emu_request(emu, UHID_GET_REPORT,
+				      ev.u.get_report.id);
+	default:
+		break;
+	}
+	return 0;
+}
+
+int sc_emu_timeout(const struct sc_emu *emu)
+{
+	uint64_t due, now;
+
+	if (!emu->pending)
+		return -1;
+
+	due = emu->pending_due.tv_sec * 1000000000ull +
+	      emu->pending_due.tv_nsec;
+	now = sc_emu_now();
+	if (due <= now)
+		return 0;
+	return (due - now + 999999) / 1000000;
+}
+
+int sc_emu_flush(struct sc_emu *emu)
+{
+	if (!emu->pending || sc_emu_timeout(emu) != 0)
+		return 0;
+
+	emu->pending = false;
+	return sc_emu_answer(emu, emu->pending_type, emu->pending_id);
+}
+
+int sc_emu_service(struct sc_emu *emu, int timeout_ms)
+{
+	struct pollfd fd = { .fd = emu->fd, .events = POLLIN };
+	int timeout, ret;
+
+	timeout = sc_emu_timeout(emu);
+	if (timeout < 0 || timeout > timeout_ms)
+		timeout = timeout_ms;
+
+	ret = poll(&fd, 1, timeout);
+	if (ret < 0)
+		return errno == EINTR ? 0 : -errno;
+	if (fd.revents & POLLIN) {
+		ret = sc_emu_dispatch(emu);
+		if (ret < 0)
+			return ret;
+	}
+	return sc_emu_flush(emu);
+}
+
+static void put_le16(uint8_t *p, int16_t value)
+{
+	p[0] = (uint16_t)value & 0xff;
+	p[1] = (uint16_t)value >> 8;
+}
+
+void sc_emu_encode(struct sc_emu *emu, const struct sc_state *state,
+		   uint8_t frame[SC_FRAME_SIZE])
+{
+	int i;
+
+	memset(frame, 0, SC_FRAME_SIZE);
+	frame[0] = 0x01;
+	frame[SC_OFFSET_TYPE] = SC_FRAME_INPUT;
+	frame[SC_OFFSET_LENGTH] = 60;
+
+	/* The first byte of the buttons is the last byte of the seqnum */
+	++emu->seqnum;
+	for (i = 0; i < 4; ++i)
+		frame[SC_OFFSET_SEQNUM+i] = emu->seqnum >> i*8;
+	for (i = 1; i < 4; ++i)
+		frame[SC_OFFSET_BUTTONS+i] = state->buttons >> i*8;
+
+	for (i = 0; i < 2; ++i) {
+		frame[SC_OFFSET_TRIGGERS_8+i] = state->triggers[i];
+		put_le16(&frame[SC_OFFSET_LEFT_AXES+2*i], state->left[i]);
+		put_le16(&frame[SC_OFFSET_RIGHT_AXES+2*i], state->right[i]);
+	}
+	for (i = 0; i < 3; ++i) {
+		put_le16(&frame[SC_OFFSET_ACCEL+2*i], state->accel[i]);
+		put_le16(&frame[SC_OFFSET_GYRO+2*i], state->gyro[i]);
+	}
+}
+
+/* Returns 1 if the frame was sent, 0 if the device could not send it */
+int sc_emu_send_raw(struct sc_emu *emu, const uint8_t frame[SC_FRAME_SIZE])
+{
+	struct uhid_event ev;
+	int ret;
+
+	/* The host does not poll a closed device */
+	if (!emu->opened)
+		return 0;
+
+	/* Lost on the way, as if the host had not polled */
+	if (frame[SC_OFFSET_TYPE] == SC_FRAME_INPUT &&
+	    sc_emu_fault_due(emu->config.faults.drop_every,
+			     ++emu->input_frames)) {
+		++emu->faults_injected;
+		return 0;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_INPUT2;
+	ev.u.input2.size = SC_FRAME_SIZE;
+	memcpy(ev.u.input2.data, frame, SC_FRAME_SIZE);
+	ret = sc_emu_write(emu, &ev);
+	return ret < 0 ? ret : 1;
+}
+
+int sc_emu_send_state(struct sc_emu *emu, const struct sc_state *state)
+{
+	uint8_t frame[SC_FRAME_SIZE];
+
+	if (!emu->connected)
+		return 0;
+
+	sc_emu_encode(emu, state, frame);
+	return sc_emu_send_raw(emu, frame);
+}
+
+int sc_emu_send_connection(struct sc_emu *emu, uint8_t event)
+{
+	uint8_t frame[SC_FRAME_SIZE];
+
+	if (event == SC_CONNECTION_CONNECTED)
+		emu->connected = true;
+	else if (event == SC_CONNECTION_DISCONNECTED)
+		emu->connected = false;
+
+	memset(frame, 0, SC_FRAME_SIZE);
+	frame[0] = 0x01;
+	frame[SC_OFFSET_TYPE] = SC_FRAME_CONNECTION;
+	frame[SC_OFFSET_LENGTH] = 1;
+	frame[4] = event;
+	return sc_emu_send_raw(emu, frame);
+}
@@ -0,0 +1,148 @@
+/*
+ * uhid based Steam Controller emulation
+ *
+ * Copyright (c) 2015 Clement Vuchener
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#ifndef SC_EMU_H
+#define SC_EMU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#define SC_VENDOR_ID		0x28de
+#define SC_PRODUCT_WIRED	0x1102
+#define SC_PRODUCT_RECEIVER	0x1142
+
+#define SC_FRAME_SIZE		64
+#define SC_FEATURE_SIZE		65
+#define SC_REPORT_DESC_SIZE	33
+
+/* Frame types, see valve_sc_raw_event */
+#define SC_FRAME_INPUT		0x01
+#define SC_FRAME_CONNECTION	0x03
+
+#define SC_CONNECTION_DISCONNECTED	0x01
+#define SC_CONNECTION_CONNECTED		0x02
+#define SC_CONNECTION_PAIRED		0x03
+
+/* Button mask, see hid-valve-sc.c */
+#define SC_BTN_TOUCH_RIGHT	0x10000000
+#define SC_BTN_TOUCH_LEFT	0x08000000
+#define SC_BTN_CLICK_RIGHT	0x04000000
+#define SC_BTN_CLICK_LEFT	0x02000000
+#define SC_BTN_A		0x00008000
+
+#define SC_FEATURE_DISABLE_AUTO_BUTTONS	0x81
+#define SC_FEATURE_ENABLE_AUTO_BUTTONS	0x85
+#define SC_FEATURE_SETTINGS		0x87
+#define SC_FEATURE_HAPTIC		0x8f
+#define SC_FEATURE_GET_SERIAL		0xae
+#define SC_FEATURE_GET_CONNECTION_STATE	0xb4
+
+/* Decoded content of an input frame */
+struct sc_state {
+	uint32_t buttons;
+	int16_t left[2];
+	int16_t right[2];
+	uint8_t triggers[2];
+	int16_t accel[3];
+	int16_t gyro[3];
+};
+
+/* Faults injected by the emulator, each one on every Nth occasion (0 never) */
+struct sc_emu_faults {
+	/* Extra delay before answering GET_REPORT requests */
+	unsigned int get_delay_ms;
+	/* GET_REPORT answered with half a report */
+	unsigned int short_every;
+	/* GET_REPORT answered with another feature id */
+	unsigned int wrong_id_every;
+	/* GET_REPORT answered with a length larger than the report */
+	unsigned int oversize_every;
+	/* Input frames not sent */
+	unsigned int drop_every;
+};
+
+struct sc_emu_config {
+	uint16_t product;
+	const char *serial;
+	/* Delay before answering feature requests */
+	unsigned int answer_delay_ms;
+	struct sc_emu_faults faults;
+	bool verbose;
+};
+
+struct sc_emu {
+	int fd;
+	int index;
+	struct sc_emu_config config;
+	char serial[32];
+	bool opened;
+	bool connected;
+	uint32_t seqnum;
+	/* Id of the last feature set, answered by the next get */
+	uint8_t feature;
+	/* Feature request waiting for its delayed answer */
+	bool pending;
+	uint32_t pending_type;
+	uint32_t pending_id;
+	struct timespec pending_due;
+	/* Requests received */
+	unsigned long set_count;
+	unsigned long get_count;
+	/* Time of the last request received and answered */
+	uint64_t last_request;
+	uint64_t last_answer;
+	/* Time of the last settings request (mouse mode, orientation) */
+	uint64_t last_settings;
+	/* Answers and frames counted for the fault schedule */
+	unsigned long get_answers;
+	unsigned long input_frames;
+	unsigned long faults_injected;
+};
+
+/* Report descriptor of the vendor interface */
+extern const uint8_t sc_report_desc[SC_REPORT_DESC_SIZE];
+
+/* Current CLOCK_MONOTONIC time in ns */
+uint64_t sc_emu_now(void);
+
+/* Parses a fault list like "delay=100,short=3,drop=10" */
+int sc_emu_parse_faults(struct sc_emu_faults *faults, const char *spec);
+
+int sc_emu_create(struct sc_emu *emu, const struct sc_emu_config *config,
+		  int index);
+void sc_emu_destroy(struct sc_emu *emu);
+
+/* Reads and handles one event from the uhid device */
+int sc_emu_dispatch(struct sc_emu *emu);
+
+/* Handles the device events for up to timeout_ms */
+int sc_emu_service(struct sc_emu *emu, int timeout_ms);
+
+/* Returns the poll timeout in ms needed by a pending answer, or -1 */
+int sc_emu_timeout(const struct sc_emu *emu);
+/* Sends the pending answer if it is due */
+int sc_emu_flush(struct sc_emu *emu);
+
+void sc_emu_encode(struct sc_emu *emu, const struct sc_state *state,
+		   uint8_t frame[SC_FRAME_SIZE]);
+/* Content of the feature report answering a GET_REPORT, without the report
+ * number: feature id, answer length, answer.
+ */
+void sc_emu_feature(const struct sc_emu *emu, uint8_t data[SC_FRAME_SIZE]);
+
+int sc_emu_send_raw(struct sc_emu *emu, const uint8_t frame[SC_FRAME_SIZE]);
+int sc_emu_send_state(struct sc_emu *emu, const struct sc_state *state);
+int sc_emu_send_connection(struct sc_emu *emu, uint8_t event);
+
+#endif
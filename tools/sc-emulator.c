@@ -0,0 +1,286 @@
+/*
+ * Steam Controller and wireless receiver emulator
+ *
+ * Copyright (c) 2015 Clement Vuchener
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#include "sc-emu.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_DEVICES	64
+#define MAX_SCRIPT	4096
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -r          emulate receiver slots instead of wired controllers\n"
+		"  -n COUNT    number of devices (default 1, max %d)\n"
+		"  -s SERIAL   serial prefix, the device index is appended\n"
+		"  -f RATE     input frames per second (default 250, 0 for none)\n"
+		"  -d MS       delay before answering feature requests\n"
+		"  -F FAULTS   faults to inject, comma separated NAME=VALUE among\n"
+		"              delay (extra GET delay in ms), and short, wrong_id,\n"
+		"              oversize (GET answers), drop (input frames) for one\n"
+		"              in VALUE\n"
+		"  -S FILE     script of input frames to loop over\n"
+		"  -c          receiver slots start connected\n"
+		"  -v          log feature requests\n"
+		"\n"
+		"Commands read from stdin, for one device or all of them:\n"
+		"  connect [INDEX], disconnect [INDEX], pair [INDEX], quit\n",
+		name, MAX_DEVICES);
+}
+
+/* Script lines are key=value fields, missing fields are 0:
+ * buttons=0x8000 lx=0 ly=0 rx=0 ry=0 lt=0 rt=0 ax=0 ay=0 az=0 gx=0 gy=0 gz=0
+ */
+static int parse_state(char *line, struct sc_state *state)
+{
+	static const struct {
+		const char *key;
+		size_t offset;
+		int size;
+	} fields[] = {
+		{ "lx", offsetof(struct sc_state, left[0]), 2 },
+		{ "ly", offsetof(struct sc_state, left[1]), 2 },
+		{ "rx", offsetof(struct sc_state, right[0]), 2 },
+		{ "ry", offsetof(struct sc_state, right[1]), 2 },
+		{ "lt", offsetof(struct sc_state, triggers[0]), 1 },
+		{ "rt", offsetof(struct sc_state, triggers[1]), 1 },
+		{ "ax", offsetof(struct sc_state, accel[0]), 2 },
+		{ "ay", offsetof(struct sc_state, accel[1]), 2 },
+		{ "az", offsetof(struct sc_state, accel[2]), 2 },
+		{ "gx", offsetof(struct sc_state, gyro[0]), 2 },
+		{ "gy", offsetof(struct sc_state, gyro[1]), 2 },
+		{ "gz", offsetof(struct sc_state, gyro[2]), 2 },
+	};
+	char *token, *value;
+	long number;
+	unsigned int i;
+
+	memset(state, 0, sizeof(*state));
+	for (token = strtok(line, " \t\n"); token;
+	     token = strtok(NULL, " \t\n")) {
+		value = strchr(token, '=');
+		if (!value)
+			return -EINVAL;
+		*value++ = '\0';
+		number = strtol(value, NULL, 0);
+
+		if (strcmp(token, "buttons") == 0) {
+			state->buttons = number;
+			continue;
+		}
+		for (i = 0; i < sizeof(fields)/sizeof(fields[0]); ++i) {
+			if (strcmp(token, fields[i].key) != 0)
+				continue;
+			if (fields[i].size == 1)
+				*((uint8_t *)state + fields[i].offset) = number;
+			else
+				*(int16_t *)((uint8_t *)state + fields[i].offset) = number;
+			break;
+		}
+		if (i == sizeof(fields)/sizeof(fields[0]))
+			return -EINVAL;
+	}
+	return 0;
+}
+
+static int load_script(const char *path, struct sc_state *script)
+{
+	FILE *file;
+	char line[512];
+	int count = 0, lineno = 0;
+
+	file = fopen(path, "r");
+	if (!file)
+		return -errno;
+
+	while (count < MAX_SCRIPT && fgets(line, sizeof(line), file)) {
+		++lineno;
+		if (line[0] == '#' || line[strspn(line, " \t\n")] == '\0')
+			continue;
+		if (parse_state(line, &script[count]) < 0) {
+			fprintf(stderr, "%s:%d: invalid line\n", path, lineno);
+			fclose(file);
+			return -EINVAL;
+		}
+		++count;
+	}
+	fclose(file);
+	return count;
+}
+
+static int run_command(char *line, struct sc_emu *emus, int count)
+{
+	char command[32];
+	int index = -1, i, first, last;
+	uint8_t event;
+
+	if (sscanf(line, "%31s %d", command, &index) < 1)
+		return 0;
+
+	if (strcmp(command, "quit") == 0)
+		return 1;
+	else if (strcmp(command, "connect") == 0)
+		event = SC_CONNECTION_CONNECTED;
+	else if (strcmp(command, "disconnect") == 0)
+		event = SC_CONNECTION_DISCONNECTED;
+	else if (strcmp(command, "pair") == 0)
+		event = SC_CONNECTION_PAIRED;
+	else {
+		fprintf(stderr, "Unknown command: %s\n", command);
+		return 0;
+	}
+
+	if (index >= count) {
+		fprintf(stderr, "Invalid device index: %d\n", index);
+		return 0;
+	}
+	first = index < 0 ? 0 : index;
+	last = index < 0 ? count - 1 : index;
+	for (i = first; i <= last; ++i)
+		sc_emu_send_connection(&emus[i], event);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	static struct sc_emu emus[MAX_DEVICES];
+	static struct sc_state script[MAX_SCRIPT];
+	struct sc_emu_config config = {
+		.product = SC_PRODUCT_WIRED,
+	};
+	struct pollfd fds[MAX_DEVICES + 1];
+	int count = 1, script_len = 1, script_pos = 0;
+	unsigned int rate = 250;
+	bool connected = false, quit = false;
+	uint64_t next_frame, now;
+	char line[128];
+	int opt, i, ret, timeout;
+
+	while ((opt = getopt(argc, argv, "rn:s:f:d:F:S:cvh")) != -1) {
+		switch (opt) {
+		case 'r':
+			config.product = SC_PRODUCT_RECEIVER;
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 's':
+			config.serial = optarg;
+			break;
+		case 'f':
+			rate = atoi(optarg);
+			break;
+		case 'd':
+			config.answer_delay_ms = atoi(optarg);
+			break;
+		case 'F':
+			if (sc_emu_parse_faults(&config.faults, optarg) < 0) {
+				fprintf(stderr, "Invalid faults: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'S':
+			script_len = load_script(optarg, script);
+			if (script_len <= 0) {
+				fprintf(stderr, "Failed to load script %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'c':
+			connected = true;
+			break;
+		case 'v':
+			config.verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (count < 1 || count > MAX_DEVICES) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < count; ++i) {
+		ret = sc_emu_create(&emus[i], &config, i);
+		if (ret < 0) {
+			fprintf(stderr, "Failed to create uhid device: %s\n",
+				strerror(-ret));
+			while (i--)
+				sc_emu_destroy(&emus[i]);
+			return EXIT_FAILURE;
+		}
+		/* Answered by GET_CONNECTION_STATE at probe */
+		if (connected)
+			emus[i].connected = true;
+		fds[i].fd = emus[i].fd;
+		fds[i].events = POLLIN;
+	}
+	fds[count].fd = STDIN_FILENO;
+	fds[count].events = POLLIN;
+
+	next_frame = sc_emu_now();
+	while (!quit) {
+		timeout = -1;
+		if (rate) {
+			now = sc_emu_now();
+			timeout = next_frame > now ?
+				  (next_frame - now) / 1000000 : 0;
+		}
+		for (i = 0; i < count; ++i) {
+			ret = sc_emu_timeout(&emus[i]);
+			if (ret >= 0 && (timeout < 0 || ret < timeout))
+				timeout = ret;
+		}
+
+		ret = poll(fds, count + 1, timeout);
+		if (ret < 0 && errno != EINTR) {
+			perror("poll");
+			break;
+		}
+
+		for (i = 0; i < count; ++i) {
+			if (fds[i].revents & POLLIN)
+				sc_emu_dispatch(&emus[i]);
+			sc_emu_flush(&emus[i]);
+		}
+
+		if (fds[count].revents & (POLLIN | POLLHUP)) {
+			if (!fgets(line, sizeof(line), stdin))
+				fds[count].fd = -1;
+			else if (run_command(line, emus, count))
+				quit = true;
+		}
+
+		if (rate && sc_emu_now() >= next_frame) {
+			for (i = 0; i < count; ++i)
+				sc_emu_send_state(&emus[i], &script[script_pos]);
+			script_pos = (script_pos + 1) % script_len;
+			next_frame += 1000000000ull / rate;
+		}
+	}
+
+	for (i = 0; i < count; ++i)
+		sc_emu_destroy(&emus[i]);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,159 @@
+/*
+ * Helpers for the driver evdev nodes and sysfs attributes
+ *
+ * Copyright (c) 2015 Clement Vuchener
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#include "sc-evdev.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SENSOR_SUFFIX	" Accelerometer"
+
+static bool has_suffix(const char *str, const char *suffix)
+{
+	size_t len = strlen(str), suffix_len = strlen(suffix);
+
+	return len >= suffix_len &&
+	       strcmp(str + len - suffix_len, suffix) == 0;
+}
+
+int sc_input_read(const char *event, const char *attr, char *buf, size_t size)
+{
+	char dir[300];
+	int len;
+
+	snprintf(dir, sizeof(dir), "/sys/class/input/%s/device", event);
+	len = sc_sysfs_read(dir, attr, buf, size);
+	if (len > 0 && buf[len - 1] == '\n')
+		buf[--len] = '\0';
+	return len;
+}
+
+int sc_evdev_open_mode(const char *serial, bool sensor, int mode)
+{
+	DIR *dir;
+	struct dirent *entry;
+	char path[300], name[256], uniq[64];
+	int fd, clock = CLOCK_MONOTONIC;
+
+	dir = opendir("/sys/class/input");
+	if (!dir)
+		return -errno;
+
+	/* Matched through sysfs: opening the other nodes would make the
+	 * driver send their open and close requests.
+	 */
+	while ((entry = readdir(dir))) {
+		if (strncmp(entry->d_name, "event", 5) != 0)
+			continue;
+		if (sc_input_read(entry->d_name, "uniq", uniq, sizeof(uniq)) < 0 ||
+		    strcmp(uniq, serial) != 0 ||
+		    sc_input_read(entry->d_name, "name", name, sizeof(name)) < 0 ||
+		    has_suffix(name, SENSOR_SUFFIX) != sensor)
+			continue;
+
+		snprintf(path, sizeof(path), "/dev/input/%s", entry->d_name);
+		fd = open(path, mode | O_NONBLOCK | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+		if (ioctl(fd, EVIOCSCLOCKID, &clock) < 0) {
+			close(fd);
+			continue;
+		}
+		closedir(dir);
+		return fd;
+	}
+
+	closedir(dir);
+	return -ENOENT;
+}
+
+int sc_evdev_open(const char *serial, bool sensor)
+{
+	return sc_evdev_open_mode(serial, sensor, O_RDONLY);
+}
+
+int sc_sysfs_find(int index, char *dir, size_t size)
+{
+	DIR *devices;
+	struct dirent *entry;
+	char path[300], line[128], phys[64];
+	FILE *file;
+	bool found = false;
+
+	snprintf(phys, sizeof(phys), "HID_PHYS=sc-emu/%d\n", index);
+	devices = opendir("/sys/bus/hid/devices");
+	if (!devices)
+		return -errno;
+	while (!found && (entry = readdir(devices))) {
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "/sys/bus/hid/devices/%s/uevent",
+			 entry->d_name);
+		file = fopen(path, "r");
+		if (!file)
+			continue;
+		while (fgets(line, sizeof(line), file)) {
+			if (strcmp(line, phys) == 0) {
+				found = true;
+				break;
+			}
+		}
+		fclose(file);
+		if (found)
+			snprintf(dir, size, "/sys/bus/hid/devices/%s",
+				 entry->d_name);
+	}
+	closedir(devices);
+	return found ? 0 : -ENOENT;
+}
+
+int sc_sysfs_read(const char *dir, const char *attr, char *buf, size_t size)
+{
+	char path[400];
+	ssize_t len;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	len = read(fd, buf, size - 1);
+	close(fd);
+	if (len < 0)
+		return -errno;
+	buf[len] = '\0';
+	return len;
+}
+
+int sc_sysfs_write(const char *dir, const char *attr, const char *value)
+{
+	char path[400];
+	ssize_t len;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	len = write(fd, value, strlen(value));
+	close(fd);
+	if (len < 0)
+		return -errno;
+	return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * Helpers for the driver evdev nodes and sysfs attributes
+ *
+ * Copyright (c) 2015 Clement Vuchener
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#ifndef SC_EVDEV_H
+#define SC_EVDEV_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/input.h>
+
+/* Opens the gamepad (or sensor) evdev node of the controller with the given
+ * serial, with monotonic timestamps. Returns the fd or a negative errno.
+ */
+int sc_evdev_open(const char *serial, bool sensor);
+/* Same with the given access mode (O_RDONLY, O_RDWR) */
+int sc_evdev_open_mode(const char *serial, bool sensor, int mode);
+
+/* Reads an attribute (name, uniq...) of the input device of an evdev node
+ * (eventN) without opening it. Returns the length read, without the newline,
+ * or a negative errno.
+ */
+int sc_input_read(const char *event, const char *attr, char *buf, size_t size);
+
+/* Event timestamp in ns */
+static inline uint64_t sc_evdev_time(const struct input_event *ev)
+{
+	return (uint64_t)ev->input_event_sec * 1000000000ull +
+	       (uint64_t)ev->input_event_usec * 1000ull;
+}
+
+/* Finds the sysfs directory of the HID device created by sc_emu_create
+ * with the given index.
+ */
+int sc_sysfs_find(int index, char *dir, size_t size);
+/* Returns the length read or a negative errno */
+int sc_sysfs_read(const char *dir, const char *attr, char *buf, size_t size);
+int sc_sysfs_write(const char *dir, const char *attr, const char *value);
+
+#endif
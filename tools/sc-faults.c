@@ -0,0 +1,278 @@
+/*
+ * Driver behaviour under controller faults
+ *
+ * Copyright (c) 2015 Clement Vuchener
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#include "sc-emu.h"
+#include "sc-evdev.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define MAX_PROFILES	32
+#define INPUT_FRAMES	500
+
+static const char *const default_profiles[] = {
+	"none",
+	"delay=20",
+	"delay=500",
+	"delay=6000",
+	"short=1",
+	"short=2",
+	"wrong_id=1",
+	"oversize=1",
+	"drop=10",
+};
+
+static unsigned int quiet_ms = 300;
+
+struct operation {
+	struct sc_emu *emu;
+	const char *sysfs;
+	uint64_t start;
+	unsigned long set, get;
+	long errors;
+};
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -F FAULTS   fault profile to run, may be repeated (default: a\n"
+		"              built-in list), see sc-emulator -F for the syntax\n"
+		"  -q MS       time without requests ending an operation (default 300)\n",
+		name);
+}
+
+static long control_errors(const char *sysfs)
+{
+	char value[32];
+
+	if (!sysfs[0] || sc_sysfs_read(sysfs, "statistics/control_errors",
+					value, sizeof(value)) < 0)
+		return -1;
+	return strtol(value, NULL, 10);
+}
+
+/* Handles the requests until none came for quiet_ms */
+static void settle(struct sc_emu *emu, uint64_t start)
+{
+	uint64_t last;
+
+	for (;;) {
+		last = emu->last_request > start ? emu->last_request : start;
+		if (!emu->pending &&
+		    sc_emu_now() >= last + quiet_ms * 1000000ull)
+			break;
+		sc_emu_service(emu, 10);
+	}
+}
+
+static void begin(struct operation *op, struct sc_emu *emu, const char *sysfs)
+{
+	op->emu = emu;
+	op->sysfs = sysfs;
+	op->set = emu->set_count;
+	op->get = emu->get_count;
+	op->errors = control_errors(sysfs);
+	op->start = sc_emu_now();
+}
+
+/* The operation blocks until its last request is answered, or its own end */
+static void end(struct operation *op, const char *name, uint64_t done)
+{
+	struct sc_emu *emu = op->emu;
+	uint64_t last;
+
+	settle(emu, op->start);
+	last = emu->last_request > done ? emu->last_request : done;
+	if (emu->last_answer > last)
+		last = emu->last_answer;
+	printf(", \"%s\": {\"ms\": %.1f, \"set\": %lu, \"get\": %lu, "
+	       "\"errors\": %ld}", name,
+	       last > op->start ? (last - op->start) / 1e6 : 0.0,
+	       emu->set_count - op->set, emu->get_count - op->get,
+	       control_errors(op->sysfs) - op->errors);
+}
+
+static int16_t abs_x(int fd)
+{
+	struct input_absinfo absinfo;
+
+	if (fd < 0 || ioctl(fd, EVIOCGABS(ABS_X), &absinfo) < 0)
+		return INT16_MIN;
+	return absinfo.value;
+}
+
+/* Streams frames moving the stick back and forth, and counts its events */
+static void run_input(struct sc_emu *emu, int gamepad)
+{
+	struct sc_state state = { 0 };
+	struct input_event ev;
+	unsigned long sent = 0, events = 0, injected = emu->faults_injected;
+	unsigned int i;
+
+	for (i = 0; i < INPUT_FRAMES; ++i) {
+		state.left[0] = i % 2 ? 10000 : -10000;
+		if (sc_emu_send_state(emu, &state) > 0)
+			++sent;
+		sc_emu_service(emu, 1);
+		while (gamepad >= 0 && read(gamepad, &ev, sizeof(ev)) == sizeof(ev))
+			if (ev.type == EV_ABS && ev.code == ABS_X)
+				++events;
+	}
+	printf(", \"input\": {\"sent\": %lu, \"dropped\": %lu, "
+	       "\"stick_events\": %ld, \"final_state\": %s}",
+	       sent, emu->faults_injected - injected,
+	       gamepad >= 0 ? (long)events : -1,
+	       abs_x(gamepad) == state.left[0] ? "true" : "false");
+}
+
+/* Time for a fault-free connection to give a working gamepad */
+static void run_recovery(struct sc_emu *emu, const char *sysfs, int *gamepad)
+{
+	struct sc_state state = { .left = { 12345, 0 } };
+	uint64_t start, deadline, done = 0;
+	long errors;
+
+	memset(&emu->config.faults, 0, sizeof(emu->config.faults));
+	sc_emu_send_connection(emu, SC_CONNECTION_DISCONNECTED);
+	settle(emu, sc_emu_now());
+
+	errors = control_errors(sysfs);
+	start = sc_emu_now();
+	deadline = start + 10000000000ull;
+	sc_emu_send_connection(emu, SC_CONNECTION_CONNECTED);
+	while (!done && sc_emu_now() < deadline) {
+		sc_emu_send_state(emu, &state);
+		sc_emu_service(emu, 4);
+		/* A new serial makes new input devices */
+		if (*gamepad >= 0 && abs_x(*gamepad) == INT16_MIN) {
+			close(*gamepad);
+			*gamepad = -1;
+		}
+		if (*gamepad < 0)
+			*gamepad = sc_evdev_open(emu->serial, false);
+		if (abs_x(*gamepad) == state.left[0])
+			done = sc_emu_now();
+	}
+	settle(emu, start);
+	printf(", \"recovery\": {\"ms\": %.1f, \"errors\": %ld}",
+	       done ? (done - start) / 1e6 : -1.0,
+	       control_errors(sysfs) - errors);
+}
+
+static int run_profile(const char *spec, int index)
+{
+	struct sc_emu_config config = {
+		.product = SC_PRODUCT_RECEIVER,
+		.serial = "FAULT",
+	};
+	struct sc_emu emu;
+	struct operation op;
+	char sysfs[300] = "";
+	uint64_t deadline, probed = 0;
+	int gamepad = -1, ret;
+
+	ret = sc_emu_parse_faults(&config.faults, spec);
+	if (ret < 0)
+		return ret;
+	ret = sc_emu_create(&emu, &config, index);
+	if (ret < 0)
+		return ret;
+	/* Answered by GET_CONNECTION_STATE, so probe also reads the serial */
+	emu.connected = true;
+
+	printf("%s  {\"faults\": \"%s\"", index ? ",\n" : "", spec);
+
+	/* The attributes are created at the end of probe */
+	begin(&op, &emu, sysfs);
+	deadline = op.start + 30000000000ull;
+	while (!probed && sc_emu_now() < deadline) {
+		sc_emu_service(&emu, 1);
+		if (sc_sysfs_find(emu.index, sysfs, sizeof(sysfs)) == 0)
+			probed = sc_emu_now();
+	}
+	if (!probed) {
+		printf(", \"probe\": null}");
+		sc_emu_destroy(&emu);
+		return 0;
+	}
+	/* No errors counter before probe */
+	op.errors = 0;
+	end(&op, "probe", probed);
+
+	sc_emu_send_connection(&emu, SC_CONNECTION_DISCONNECTED);
+	settle(&emu, sc_emu_now());
+	begin(&op, &emu, sysfs);
+	sc_emu_send_connection(&emu, SC_CONNECTION_CONNECTED);
+	end(&op, "connect", sc_emu_now());
+
+	gamepad = sc_evdev_open(emu.serial, false);
+	printf(", \"serial_ok\": %s", gamepad >= 0 ? "true" : "false");
+	run_input(&emu, gamepad);
+	run_recovery(&emu, sysfs, &gamepad);
+	printf(", \"injected\": %lu}", emu.faults_injected);
+	fflush(stdout);
+
+	if (gamepad >= 0)
+		close(gamepad);
+	sc_emu_destroy(&emu);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *profiles[MAX_PROFILES];
+	struct sc_emu_faults faults;
+	int count = 0, i, opt, ret;
+
+	while ((opt = getopt(argc, argv, "F:q:h")) != -1) {
+		switch (opt) {
+		case 'F':
+			if (sc_emu_parse_faults(&faults, optarg) < 0) {
+				fprintf(stderr, "Invalid faults: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			if (count < MAX_PROFILES)
+				profiles[count++] = optarg;
+			break;
+		case 'q':
+			quiet_ms = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (!count) {
+		for (i = 0; i < (int)(sizeof(default_profiles) /
+				      sizeof(default_profiles[0])); ++i)
+			profiles[count++] = default_profiles[i];
+	}
+
+	printf("[\n");
+	for (i = 0; i < count; ++i) {
+		ret = run_profile(profiles[i], i);
+		if (ret < 0) {
+			fprintf(stderr, "\nFailed to run %s: %s\n", profiles[i],
+				strerror(-ret));
+			return EXIT_FAILURE;
+		}
+	}
+	printf("\n]\n");
+	return EXIT_SUCCESS;
+}
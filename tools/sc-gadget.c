@@ -0,0 +1,757 @@
+/*
+ * Steam Controller and wireless receiver USB gadget
+ *
+ * Copyright (c) 2015 Clement Vuchener
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/*
+ * The gadget is made with configfs and a FunctionFS function holding all the
+ * interfaces, the same as the real devices:
+ *
+ *   wired controller (28de:1102): 0 mouse, 1 keyboard, 2 controller
+ *   wireless receiver (28de:1142): 0 keyboard, 1-4 controller slots
+ *
+ * The host side is the usual usbhid and valve-sc path, through dummy_hcd
+ * when there is no real device controller.
+ */
+
+#include "sc-emu.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <endian.h>
+#include <linux/usb/ch9.h>
+#include <linux/usb/functionfs.h>
+
+#define CONFIGFS_GADGETS	"/sys/kernel/config/usb_gadget"
+#define GADGET_NAME		"sc-gadget"
+#define FFS_NAME		"sc"
+
+#define MAX_INTERFACES		5
+#define MAX_SLOTS		4
+
+#define HID_DT_HID		0x21
+#define HID_DT_REPORT		0x22
+#define HID_REQ_GET_REPORT	0x01
+#define HID_REQ_SET_IDLE	0x0a
+#define HID_REQ_SET_PROTOCOL	0x0b
+#define HID_REQ_SET_REPORT	0x09
+
+enum interface_kind {
+	INTERFACE_MOUSE,
+	INTERFACE_KEYBOARD,
+	INTERFACE_CONTROLLER,
+};
+
+/* Boot protocol descriptors of the lizard mode interfaces */
+static const uint8_t keyboard_report_desc[] = {
+	0x05, 0x01, 0x09, 0x06, 0xa1, 0x01, 0x05, 0x07,
+	0x19, 0xe0, 0x29, 0xe7, 0x15, 0x00, 0x25, 0x01,
+	0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0x95, 0x01,
+	0x75, 0x08, 0x81, 0x01, 0x95, 0x06, 0x75, 0x08,
+	0x15, 0x00, 0x25, 0x65, 0x05, 0x07, 0x19, 0x00,
+	0x29, 0x65, 0x81, 0x00, 0xc0,
+};
+
+static const uint8_t mouse_report_desc[] = {
+	0x05, 0x01, 0x09, 0x02, 0xa1, 0x01, 0x09, 0x01,
+	0xa1, 0x00, 0x05, 0x09, 0x19, 0x01, 0x29, 0x03,
+	0x15, 0x00, 0x25, 0x01, 0x95, 0x03, 0x75, 0x01,
+	0x81, 0x02, 0x95, 0x01, 0x75, 0x05, 0x81, 0x01,
+	0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x09, 0x38,
+	0x15, 0x81, 0x25, 0x7f, 0x75, 0x08, 0x95, 0x03,
+	0x81, 0x06, 0xc0, 0xc0,
+};
+
+struct interface {
+	enum interface_kind kind;
+	const uint8_t *report_desc;
+	uint16_t report_desc_size;
+	uint16_t packet_size;
+};
+
+struct slot {
+	struct sc_emu emu;
+	pthread_mutex_t lock;
+	/* Connection event waiting to be sent */
+	uint8_t event;
+	unsigned int rate;
+	char ep_path[300];
+	pthread_t thread;
+	bool started;
+};
+
+struct gadget {
+	uint16_t product;
+	struct interface interfaces[MAX_INTERFACES];
+	int interface_count;
+	/* First controller interface */
+	int first_slot;
+	struct slot slots[MAX_SLOTS];
+	int slot_count;
+	unsigned int rate;
+	char mountpoint[256];
+	char udc[256];
+	bool verbose;
+};
+
+static volatile sig_atomic_t stop;
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -r          emulate a wireless receiver instead of a wired controller\n"
+		"  -s SERIAL   serial prefix, the slot index is appended\n"
+		"  -f RATE     input frames per second (default 250, 0 for none)\n"
+		"  -c          receiver slots start connected\n"
+		"  -u UDC      device controller (default: the first one)\n"
+		"  -m DIR      FunctionFS mount point (default /tmp/sc-gadget)\n"
+		"  -v          log control requests\n"
+		"\n"
+		"Commands read from stdin, for one slot or all of them:\n"
+		"  connect [INDEX], disconnect [INDEX], pair [INDEX], quit\n",
+		name);
+}
+
+static void handle_signal(int sig)
+{
+	stop = 1;
+}
+
+static int write_file(const char *dir, const char *name, const char *value)
+{
+	char path[512];
+	int fd, ret = 0;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	if (write(fd, value, strlen(value)) < 0)
+		ret = -errno;
+	close(fd);
+	return ret;
+}
+
+static int make_dir(const char *path)
+{
+	if (mkdir(path, 0755) < 0 && errno != EEXIST)
+		return -errno;
+	return 0;
+}
+
+static void remove_configfs(void)
+{
+	const char *gadget = CONFIGFS_GADGETS "/" GADGET_NAME;
+
+	write_file(gadget, "UDC", "\n");
+	unlink(CONFIGFS_GADGETS "/" GADGET_NAME "/configs/c.1/ffs." FFS_NAME);
+	rmdir(CONFIGFS_GADGETS "/" GADGET_NAME "/configs/c.1/strings/0x409");
+	rmdir(CONFIGFS_GADGETS "/" GADGET_NAME "/configs/c.1");
+	rmdir(CONFIGFS_GADGETS "/" GADGET_NAME "/functions/ffs." FFS_NAME);
+	rmdir(CONFIGFS_GADGETS "/" GADGET_NAME "/strings/0x409");
+	rmdir(gadget);
+}
+
+static int setup_configfs(const struct gadget *gadget)
+{
+	const char *dir = CONFIGFS_GADGETS "/" GADGET_NAME;
+	char value[32];
+	int ret;
+
+	ret = make_dir(dir);
+	if (ret < 0)
+		return ret;
+	snprintf(value, sizeof(value), "0x%04x", SC_VENDOR_ID);
+	ret = write_file(dir, "idVendor", value);
+	if (ret < 0)
+		return ret;
+	snprintf(value, sizeof(value), "0x%04x", gadget->product);
+	ret = write_file(dir, "idProduct", value);
+	if (ret < 0)
+		return ret;
+	write_file(dir, "bcdDevice", "0x0001");
+	write_file(dir, "bcdUSB", "0x0200");
+
+	ret = make_dir(CONFIGFS_GADGETS "/" GADGET_NAME "/strings/0x409");
+	if (ret < 0)
+		return ret;
+	write_file(CONFIGFS_GADGETS "/" GADGET_NAME "/strings/0x409",
+		   "manufacturer", "Valve Software");
+	write_file(CONFIGFS_GADGETS "/" GADGET_NAME "/strings/0x409",
+		   "product", gadget->product == SC_PRODUCT_WIRED ?
+		   "Steam Controller" : "Steam Controller Receiver");
+
+	ret = make_dir(CONFIGFS_GADGETS "/" GADGET_NAME "/configs/c.1");
+	if (ret < 0)
+		return ret;
+	write_file(CONFIGFS_GADGETS "/" GADGET_NAME "/configs/c.1",
+		   "MaxPower", "500");
+	/* Remote wakeup, for autosuspend */
+	write_file(CONFIGFS_GADGETS "/" GADGET_NAME "/configs/c.1",
+		   "bmAttributes", "0xa0");
+
+	ret = make_dir(CONFIGFS_GADGETS "/" GADGET_NAME "/functions/ffs." FFS_NAME);
+	if (ret < 0)
+		return ret;
+	if (symlink(CONFIGFS_GADGETS "/" GADGET_NAME "/functions/ffs." FFS_NAME,
+		    CONFIGFS_GADGETS "/" GADGET_NAME "/configs/c.1/ffs." FFS_NAME) < 0 &&
+	    errno != EEXIST)
+		return -errno;
+	return 0;
+}
+
+static int find_udc(char *udc, size_t size)
+{
+	DIR *dir;
+	struct dirent *entry;
+	int ret = -ENODEV;
+
+	dir = opendir("/sys/class/udc");
+	if (!dir)
+		return -errno;
+	while ((entry = readdir(dir))) {
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(udc, size, "%s", entry->d_name);
+		ret = 0;
+		break;
+	}
+	closedir(dir);
+	return ret;
+}
+
+static void put_le16(uint8_t *p, uint16_t value)
+{
+	p[0] = value & 0xff;
+	p[1] = value >> 8;
+}
+
+/* Interface, HID and endpoint descriptors of one speed */
+static size_t build_descs(const struct gadget *gadget, bool high_speed,
+			  uint8_t *buf, uint32_t *count)
+{
+	const struct interface *intf;
+	uint8_t *p = buf;
+	int i;
+
+	*count = 0;
+	for (i = 0; i < gadget->interface_count; ++i) {
+		intf = &gadget->interfaces[i];
+
+		/* Interface */
+		p[0] = USB_DT_INTERFACE_SIZE;
+		p[1] = USB_DT_INTERFACE;
+		p[2] = i;
+		p[3] = 0;
+		p[4] = 1;
+		p[5] = USB_CLASS_HID;
+		p[6] = intf->kind == INTERFACE_CONTROLLER ? 0 : 1;
+		p[7] = intf->kind == INTERFACE_MOUSE ? 2 :
+		       intf->kind == INTERFACE_KEYBOARD ? 1 : 0;
+		p[8] = 0;
+		p += USB_DT_INTERFACE_SIZE;
+
+		/* HID */
+		p[0] = 9;
+		p[1] = HID_DT_HID;
+		put_le16(&p[2], 0x0111);
+		p[4] = 0;
+		p[5] = 1;
+		p[6] = HID_DT_REPORT;
+		put_le16(&p[7], intf->report_desc_size);
+		p += 9;
+
+		/* Interrupt IN endpoint, polled every ms */
+		p[0] = USB_DT_ENDPOINT_SIZE;
+		p[1] = USB_DT_ENDPOINT;
+		p[2] = USB_DIR_IN | (i + 1);
+		p[3] = USB_ENDPOINT_XFER_INT;
+		put_le16(&p[4], intf->packet_size);
+		p[6] = high_speed ? 4 : 1;
+		p += USB_DT_ENDPOINT_SIZE;
+
+		*count += 3;
+	}
+	return p - buf;
+}
+
+static int write_descriptors(const struct gadget *gadget, int ep0)
+{
+	uint8_t buf[1024], *p;
+	uint32_t fs_count, hs_count;
+	struct usb_functionfs_strings_head strings;
+	size_t len;
+
+	p = buf + sizeof(struct usb_functionfs_descs_head_v2) + 8;
+	p += build_descs(gadget, false, p, &fs_count);
+	p += build_descs(gadget, true, p, &hs_count);
+	len = p - buf;
+
+	p = buf;
+	put_le16(p, FUNCTIONFS_DESCRIPTORS_MAGIC_V2 & 0xffff);
+	put_le16(p + 2, FUNCTIONFS_DESCRIPTORS_MAGIC_V2 >> 16);
+	put_le16(p + 4, len & 0xffff);
+	put_le16(p + 6, len >> 16);
+	put_le16(p + 8, FUNCTIONFS_HAS_FS_DESC | FUNCTIONFS_HAS_HS_DESC);
+	put_le16(p + 10, 0);
+	p += sizeof(struct usb_functionfs_descs_head_v2);
+	put_le16(p, fs_count);
+	put_le16(p + 2, 0);
+	put_le16(p + 4, hs_count);
+	put_le16(p + 6, 0);
+	if (write(ep0, buf, len) < 0)
+		return -errno;
+
+	strings.magic = htole32(FUNCTIONFS_STRINGS_MAGIC);
+	strings.length = htole32(sizeof(strings));
+	strings.str_count = 0;
+	strings.lang_count = 0;
+	if (write(ep0, &strings, sizeof(strings)) < 0)
+		return -errno;
+	return 0;
+}
+
+/* Streams the input frames and connection events of a controller slot */
+static void *slot_thread(void *data)
+{
+	struct slot *slot = data;
+	struct sc_state state;
+	uint8_t frame[SC_FRAME_SIZE];
+	struct timespec ts;
+	uint64_t next;
+	bool send;
+	int fd;
+
+	fd = open(slot->ep_path, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		perror(slot->ep_path);
+		return NULL;
+	}
+
+	memset(&state, 0, sizeof(state));
+	next = sc_emu_now();
+	while (!stop) {
+		send = true;
+		pthread_mutex_lock(&slot->lock);
+		if (slot->event) {
+			memset(frame, 0, sizeof(frame));
+			frame[0] = 0x01;
+			frame[2] = SC_FRAME_CONNECTION;
+			frame[3] = 1;
+			frame[4] = slot->event;
+			slot->event = 0;
+		} else if (slot->rate && slot->emu.connected) {
+			sc_emu_encode(&slot->emu, &state, frame);
+		} else {
+			send = false;
+		}
+		pthread_mutex_unlock(&slot->lock);
+
+		/* Blocks until the host polls the endpoint */
+		if (send && write(fd, frame, sizeof(frame)) < 0 &&
+		    errno != EINTR && errno != ESHUTDOWN) {
+			perror(slot->ep_path);
+			break;
+		}
+
+		/* Without input frames, check for events every 10 ms */
+		next += slot->rate ? 1000000000ull / slot->rate : 10000000ull;
+		ts.tv_sec = next / 1000000000ull;
+		ts.tv_nsec = next % 1000000000ull;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	}
+	close(fd);
+	return NULL;
+}
+
+static int start_slots(struct gadget *gadget)
+{
+	struct slot *slot;
+	int i, ret;
+
+	for (i = 0; i < gadget->slot_count; ++i) {
+		slot = &gadget->slots[i];
+		if (slot->started)
+			continue;
+		snprintf(slot->ep_path, sizeof(slot->ep_path), "%s/ep%d",
+			 gadget->mountpoint, gadget->first_slot + i + 1);
+		ret = pthread_create(&slot->thread, NULL, slot_thread, slot);
+		if (ret)
+			return -ret;
+		slot->started = true;
+	}
+	return 0;
+}
+
+static const struct interface *setup_interface(const struct gadget *gadget,
+					       const struct usb_ctrlrequest *req)
+{
+	unsigned int index = le16toh(req->wIndex) & 0xff;
+
+	if ((req->bRequestType & USB_RECIP_MASK) != USB_RECIP_INTERFACE ||
+	    index >= (unsigned int)gadget->interface_count)
+		return NULL;
+	return &gadget->interfaces[index];
+}
+
+static struct slot *setup_slot(struct gadget *gadget,
+			       const struct usb_ctrlrequest *req)
+{
+	int index = (le16toh(req->wIndex) & 0xff) - gadget->first_slot;
+
+	if (index < 0 || index >= gadget->slot_count)
+		return NULL;
+	return &gadget->slots[index];
+}
+
+/* Answers the control requests of the interfaces, a read on an IN request
+ * or a write on an OUT request stalls it.
+ */
+static void handle_setup(struct gadget *gadget, int ep0,
+			 const struct usb_ctrlrequest *req)
+{
+	const struct interface *intf = setup_interface(gadget, req);
+	struct slot *slot = setup_slot(gadget, req);
+	uint16_t length = le16toh(req->wLength);
+	uint16_t value = le16toh(req->wValue);
+	uint8_t data[SC_FRAME_SIZE];
+	bool in = req->bRequestType & USB_DIR_IN;
+	ssize_t ret = -1;
+
+	if (gadget->verbose)
+		fprintf(stderr, "setup %02x %02x %04x %04x %u\n",
+			req->bRequestType, req->bRequest, value,
+			le16toh(req->wIndex), length);
+
+	if (!intf)
+		goto stall;
+
+	switch (req->bRequestType & USB_TYPE_MASK) {
+	case USB_TYPE_STANDARD:
+		if (req->bRequest != USB_REQ_GET_DESCRIPTOR ||
+		    value >> 8 != HID_DT_REPORT)
+			goto stall;
+		ret = write(ep0, intf->report_desc,
+			    length < intf->report_desc_size ?
+			    length : intf->report_desc_size);
+		break;
+
+	case USB_TYPE_CLASS:
+		switch (req->bRequest) {
+		case HID_REQ_SET_IDLE:
+		case HID_REQ_SET_PROTOCOL:
+			ret = read(ep0, NULL, 0);
+			break;
+
+		case HID_REQ_SET_REPORT:
+			if (!slot || length > sizeof(data))
+				goto stall;
+			ret = read(ep0, data, length);
+			if (ret > 0) {
+				pthread_mutex_lock(&slot->lock);
+				slot->emu.feature = data[0];
+				++slot->emu.set_count;
+				pthread_mutex_unlock(&slot->lock);
+			}
+			break;
+
+		case HID_REQ_GET_REPORT:
+			if (!slot)
+				goto stall;
+			pthread_mutex_lock(&slot->lock);
+			sc_emu_feature(&slot->emu, data);
+			++slot->emu.get_count;
+			pthread_mutex_unlock(&slot->lock);
+			ret = write(ep0, data,
+				    length < sizeof(data) ? length : sizeof(data));
+			break;
+
+		default:
+			goto stall;
+		}
+		break;
+
+	default:
+		goto stall;
+	}
+
+	if (ret < 0)
+		perror("ep0");
+	return;
+
+stall:
+	if (in)
+		ret = read(ep0, data, 0);
+	else
+		ret = write(ep0, data, 0);
+}
+
+static void handle_ep0(struct gadget *gadget, int ep0)
+{
+	struct usb_functionfs_event events[4];
+	ssize_t len;
+	int i, ret;
+
+	len = read(ep0, events, sizeof(events));
+	if (len < 0) {
+		if (errno != EINTR && errno != EAGAIN)
+			perror("ep0");
+		return;
+	}
+
+	for (i = 0; i < len / (ssize_t)sizeof(events[0]); ++i) {
+		switch (events[i].type) {
+		case FUNCTIONFS_ENABLE:
+			ret = start_slots(gadget);
+			if (ret < 0)
+				fprintf(stderr, "Failed to start the slots: %s\n",
+					strerror(-ret));
+			break;
+		case FUNCTIONFS_SETUP:
+			handle_setup(gadget, ep0, &events[i].u.setup);
+			break;
+		default:
+			if (gadget->verbose)
+				fprintf(stderr, "event %u\n", events[i].type);
+			break;
+		}
+	}
+}
+
+static int run_command(char *line, struct gadget *gadget)
+{
+	char command[32];
+	int index = -1, i, first, last;
+	uint8_t event;
+
+	if (sscanf(line, "%31s %d", command, &index) < 1)
+		return 0;
+
+	if (strcmp(command, "quit") == 0)
+		return 1;
+	else if (strcmp(command, "connect") == 0)
+		event = SC_CONNECTION_CONNECTED;
+	else if (strcmp(command, "disconnect") == 0)
+		event = SC_CONNECTION_DISCONNECTED;
+	else if (strcmp(command, "pair") == 0)
+		event = SC_CONNECTION_PAIRED;
+	else {
+		fprintf(stderr, "Unknown command: %s\n", command);
+		return 0;
+	}
+
+	if (index >= gadget->slot_count) {
+		fprintf(stderr, "Invalid slot index: %d\n", index);
+		return 0;
+	}
+	first = index < 0 ? 0 : index;
+	last = index < 0 ? gadget->slot_count - 1 : index;
+	for (i = first; i <= last; ++i) {
+		pthread_mutex_lock(&gadget->slots[i].lock);
+		gadget->slots[i].event = event;
+		if (event == SC_CONNECTION_CONNECTED)
+			gadget->slots[i].emu.connected = true;
+		else if (event == SC_CONNECTION_DISCONNECTED)
+			gadget->slots[i].emu.connected = false;
+		pthread_mutex_unlock(&gadget->slots[i].lock);
+	}
+	return 0;
+}
+
+static void init_layout(struct gadget *gadget)
+{
+	static const struct interface controller = {
+		INTERFACE_CONTROLLER, sc_report_desc, SC_REPORT_DESC_SIZE, 64,
+	};
+	static const struct interface keyboard = {
+		INTERFACE_KEYBOARD, keyboard_report_desc,
+		sizeof(keyboard_report_desc), 8,
+	};
+	static const struct interface mouse = {
+		INTERFACE_MOUSE, mouse_report_desc,
+		sizeof(mouse_report_desc), 8,
+	};
+	int i;
+
+	if (gadget->product == SC_PRODUCT_WIRED) {
+		gadget->interfaces[0] = mouse;
+		gadget->interfaces[1] = keyboard;
+		gadget->interfaces[2] = controller;
+		gadget->interface_count = 3;
+		gadget->first_slot = 2;
+		gadget->slot_count = 1;
+	} else {
+		gadget->interfaces[0] = keyboard;
+		for (i = 1; i <= MAX_SLOTS; ++i)
+			gadget->interfaces[i] = controller;
+		gadget->interface_count = 1 + MAX_SLOTS;
+		gadget->first_slot = 1;
+		gadget->slot_count = MAX_SLOTS;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	static struct gadget gadget = {
+		.product = SC_PRODUCT_WIRED,
+		.rate = 250,
+		.mountpoint = "/tmp/sc-gadget",
+	};
+	struct sigaction sa;
+	struct pollfd fds[2];
+	const char *serial = "GADGET";
+	char path[300], line[128];
+	bool connected = false;
+	int ep0 = -1, opt, i, ret;
+
+	while ((opt = getopt(argc, argv, "rs:f:cu:m:vh")) != -1) {
+		switch (opt) {
+		case 'r':
+			gadget.product = SC_PRODUCT_RECEIVER;
+			break;
+		case 's':
+			serial = optarg;
+			break;
+		case 'f':
+			gadget.rate = atoi(optarg);
+			break;
+		case 'c':
+			connected = true;
+			break;
+		case 'u':
+			snprintf(gadget.udc, sizeof(gadget.udc), "%s", optarg);
+			break;
+		case 'm':
+			snprintf(gadget.mountpoint, sizeof(gadget.mountpoint),
+				 "%s", optarg);
+			break;
+		case 'v':
+			gadget.verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	init_layout(&gadget);
+	for (i = 0; i < gadget.slot_count; ++i) {
+		struct sc_emu *emu = &gadget.slots[i].emu;
+
+		/* Only the state and encoding of the emulation are used */
+		emu->fd = -1;
+		emu->index = i;
+		snprintf(emu->serial, sizeof(emu->serial), "%s%02d", serial, i);
+		emu->connected = gadget.product == SC_PRODUCT_WIRED || connected;
+		emu->opened = true;
+		gadget.slots[i].rate = gadget.rate;
+		pthread_mutex_init(&gadget.slots[i].lock, NULL);
+	}
+
+	if (!gadget.udc[0] && find_udc(gadget.udc, sizeof(gadget.udc)) < 0) {
+		fprintf(stderr, "No USB device controller, is dummy_hcd loaded?\n");
+		return EXIT_FAILURE;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	/* Writes on the endpoints are interrupted when leaving */
+	sigaction(SIGUSR1, &sa, NULL);
+
+	ret = setup_configfs(&gadget);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to create the gadget in configfs: %s\n",
+			strerror(-ret));
+		goto out;
+	}
+
+	ret = make_dir(gadget.mountpoint);
+	if (ret == 0 && mount(FFS_NAME, gadget.mountpoint, "functionfs", 0,
+			      NULL) < 0)
+		ret = -errno;
+	if (ret < 0) {
+		fprintf(stderr, "Failed to mount FunctionFS: %s\n",
+			strerror(-ret));
+		goto out;
+	}
+
+	snprintf(path, sizeof(path), "%s/ep0", gadget.mountpoint);
+	ep0 = open(path, O_RDWR | O_CLOEXEC);
+	if (ep0 < 0) {
+		ret = -errno;
+		perror(path);
+		goto out;
+	}
+	ret = write_descriptors(&gadget, ep0);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to write the descriptors: %s\n",
+			strerror(-ret));
+		goto out;
+	}
+
+	ret = write_file(CONFIGFS_GADGETS "/" GADGET_NAME, "UDC", gadget.udc);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to bind to %s: %s\n", gadget.udc,
+			strerror(-ret));
+		goto out;
+	}
+
+	fds[0].fd = ep0;
+	fds[0].events = POLLIN;
+	fds[1].fd = STDIN_FILENO;
+	fds[1].events = POLLIN;
+	while (!stop) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno != EINTR)
+				perror("poll");
+			continue;
+		}
+		if (fds[0].revents & POLLIN)
+			handle_ep0(&gadget, ep0);
+		if (fds[1].revents & (POLLIN | POLLHUP)) {
+			if (!fgets(line, sizeof(line), stdin))
+				fds[1].fd = -1;
+			else if (run_command(line, &gadget))
+				stop = 1;
+		}
+	}
+
+out:
+	stop = 1;
+	/* Unbinding fails the blocked endpoint writes */
+	write_file(CONFIGFS_GADGETS "/" GADGET_NAME, "UDC", "\n");
+	for (i = 0; i < gadget.slot_count; ++i) {
+		if (!gadget.slots[i].started)
+			continue;
+		pthread_kill(gadget.slots[i].thread, SIGUSR1);
+		pthread_join(gadget.slots[i].thread, NULL);
+	}
+	if (ep0 >= 0)
+		close(ep0);
+	umount(gadget.mountpoint);
+	rmdir(gadget.mountpoint);
+	remove_configfs();
+	return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,335 @@
+/*
+ * Driver event stream dump for comparing decoder versions
+ *
+ * Copyright (c) 2015 Clement Vuchener
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#include "sc-input-shim.h"
+#include "../hid-valve-sc-decode.h"
+
+#include "sc-emu.h"
+#include "sc-evdev.h"
+#include "sc-trace.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options] TRACE\n"
+		"       %s -g TRACE\n"
+		"  -c on|off   center_touchpads setting (default on)\n"
+		"  -e FILE     compare the events with a previous dump\n"
+		"  -g          write the built-in corpus to TRACE\n"
+		"  -m          decode with the driver decoder and a model of the\n"
+		"              input core instead of the driver\n"
+		"\n"
+		"The input reports of TRACE are sent through an emulated wired\n"
+		"controller and the events of its nodes are printed as:\n"
+		"  REPORT gamepad|sensor TYPE CODE VALUE\n",
+		name, name);
+}
+
+/* Sequences around the tricky parts of the decoder: the left stick and
+ * left pad sharing fields, center_touchpads, the negated Y axes and
+ * extreme values.
+ */
+static const struct sc_state corpus[] = {
+	{ 0 },
+	/* Left stick, then its click */
+	{ .left = { 10000, -5000 } },
+	{ .left = { 10000, -5000 }, .buttons = SC_BTN_CLICK_LEFT },
+	{ .left = { 0, 0 } },
+	/* Left pad touch, click and release with the stick centered */
+	{ .buttons = SC_BTN_TOUCH_LEFT, .left = { -12000, 8000 } },
+	{ .buttons = SC_BTN_TOUCH_LEFT | SC_BTN_CLICK_LEFT,
+	  .left = { -12000, 8000 } },
+	{ .buttons = SC_BTN_TOUCH_LEFT, .left = { 3000, -3000 } },
+	{ .left = { 0, 0 } },
+	/* Left pad release while the stick is moved */
+	{ .buttons = SC_BTN_TOUCH_LEFT, .left = { 20000, 20000 } },
+	{ .left = { 5000, 0 } },
+	{ .left = { 0, 0 } },
+	/* Right pad touch, click and release */
+	{ .buttons = SC_BTN_TOUCH_RIGHT, .right = { 15000, -15000 } },
+	{ .buttons = SC_BTN_TOUCH_RIGHT | SC_BTN_CLICK_RIGHT,
+	  .right = { 15000, -15000 } },
+	{ .right = { 0, 0 } },
+	/* Click reported without touch */
+	{ .buttons = SC_BTN_CLICK_RIGHT },
+	{ 0 },
+	/* Triggers and buttons */
+	{ .triggers = { 255, 0 }, .buttons = 0x0000ff00 },
+	{ .triggers = { 0, 255 }, .buttons = 0x01f00000 },
+	{ 0 },
+	/* Extreme values, -32768 cannot be negated in 16 bits */
+	{ .buttons = SC_BTN_TOUCH_LEFT | SC_BTN_TOUCH_RIGHT,
+	  .left = { -32768, -32768 }, .right = { 32767, -32768 } },
+	{ .left = { 32767, -32768 } },
+	{ .accel = { -32768, 32767, 16384 }, .gyro = { 32767, -32768, -1 } },
+	{ 0 },
+};
+
+static int write_corpus(const char *path)
+{
+	struct sc_emu emu = { .fd = -1 };
+	struct sc_trace trace;
+	struct sc_trace_record record;
+	unsigned int i;
+	int ret;
+
+	ret = sc_trace_create(&trace, path, SC_PRODUCT_WIRED);
+	if (ret < 0)
+		return ret;
+	for (i = 0; i < sizeof(corpus)/sizeof(corpus[0]); ++i) {
+		record.timestamp = i * 4000000ull;
+		sc_emu_encode(&emu, &corpus[i], record.data);
+		ret = sc_trace_write(&trace, &record);
+		if (ret < 0)
+			break;
+	}
+	sc_trace_close(&trace);
+	return ret;
+}
+
+struct dump {
+	FILE *expected;
+	unsigned long line;
+	bool differs;
+};
+
+static void output(struct dump *dump, const char *text)
+{
+	char line[128];
+
+	fputs(text, stdout);
+	if (!dump->expected || dump->differs)
+		return;
+
+	++dump->line;
+	if (!fgets(line, sizeof(line), dump->expected))
+		line[0] = '\0';
+	if (strcmp(line, text) != 0) {
+		fprintf(stderr, "First difference at line %lu:\n"
+			"expected: %s" "got:      %s",
+			dump->line, line[0] ? line : "end of file\n", text);
+		dump->differs = true;
+	}
+}
+
+static void drain(struct dump *dump, unsigned long report, int fd,
+		  const char *node)
+{
+	struct input_event ev;
+	char text[128];
+
+	while (read(fd, &ev, sizeof(ev)) == sizeof(ev)) {
+		snprintf(text, sizeof(text), "%lu %s %u %u %d\n", report, node,
+			 ev.type, ev.code, ev.value);
+		output(dump, text);
+	}
+}
+
+static struct dump *model_dump;
+static unsigned long model_report;
+
+static void model_event(struct input_dev *dev, unsigned int type,
+			unsigned int code, int value)
+{
+	char text[128];
+
+	snprintf(text, sizeof(text), "%lu %s %u %u %d\n", model_report,
+		 (const char *)dev->data, type, code, value);
+	output(model_dump, text);
+}
+
+/* Replays the trace without uhid, the events are those the input core
+ * passes on for the devices made by valve_sc_init_input and
+ * valve_sc_init_sensor.
+ */
+static int run_model(struct dump *dump, struct sc_trace *trace,
+		     bool center_touchpads)
+{
+	static struct input_dev gamepad = {
+		.fuzz = {
+			[ABS_X] = 100, [ABS_Y] = 100,
+			[ABS_HAT0X] = 500, [ABS_HAT0Y] = 500,
+			[ABS_RX] = 500, [ABS_RY] = 500,
+			[ABS_HAT2X] = 2, [ABS_HAT2Y] = 2,
+		},
+		.event = model_event,
+		.data = "gamepad",
+	};
+	static struct input_dev sensor = {
+		.event = model_event,
+		.data = "sensor",
+	};
+	struct sc_trace_record record;
+	struct valve_sc_frame frame;
+	int ret;
+
+	model_dump = dump;
+	while ((ret = sc_trace_read(trace, &record)) > 0) {
+		if (record.data[2] != SC_FRAME_INPUT)
+			continue;
+		valve_sc_decode_frame(record.data, &frame);
+		valve_sc_report_input(&gamepad, &frame, center_touchpads);
+		valve_sc_report_sensor(&sensor, &frame);
+		++model_report;
+	}
+	return ret;
+}
+
+static int run_driver(struct dump *dump, struct sc_trace *trace,
+		      const char *center_touchpads)
+{
+	struct sc_emu_config config = {
+		.product = SC_PRODUCT_WIRED,
+		.serial = "GOLDEN",
+	};
+	struct sc_emu emu;
+	struct sc_trace_record record;
+	char sysfs[300];
+	unsigned long report = 0;
+	uint64_t deadline;
+	int gamepad = -1, sensor = -1;
+	int ret;
+
+	ret = sc_emu_create(&emu, &config, 0);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to create uhid device: %s\n",
+			strerror(-ret));
+		return ret;
+	}
+
+	/* Both nodes must be ready before the first report */
+	deadline = sc_emu_now() + 10000000000ull;
+	while ((gamepad < 0 || sensor < 0) && sc_emu_now() < deadline) {
+		sc_emu_service(&emu, 10);
+		if (gamepad < 0)
+			gamepad = sc_evdev_open(emu.serial, false);
+		if (sensor < 0)
+			sensor = sc_evdev_open(emu.serial, true);
+	}
+	ret = gamepad < 0 || sensor < 0 ? -ENOENT :
+	      sc_sysfs_find(emu.index, sysfs, sizeof(sysfs));
+	if (ret == 0)
+		ret = sc_sysfs_write(sysfs, "center_touchpads",
+				     center_touchpads);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to set the device up: %s\n",
+			strerror(-ret));
+		goto out;
+	}
+	while (!emu.opened && sc_emu_now() < deadline)
+		sc_emu_service(&emu, 10);
+
+	while ((ret = sc_trace_read(trace, &record)) > 0) {
+		if (record.data[2] != SC_FRAME_INPUT)
+			continue;
+		sc_emu_service(&emu, 0);
+		/* The driver handles the report before the write returns */
+		ret = sc_emu_send_raw(&emu, record.data);
+		if (ret == 0)
+			ret = -ENOTCONN;
+		if (ret < 0)
+			break;
+		drain(dump, report, gamepad, "gamepad");
+		drain(dump, report, sensor, "sensor");
+		++report;
+	}
+	if (ret < 0)
+		fprintf(stderr, "Replay failed: %s\n", strerror(-ret));
+
+out:
+	if (gamepad >= 0)
+		close(gamepad);
+	if (sensor >= 0)
+		close(sensor);
+	sc_emu_destroy(&emu);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sc_trace trace;
+	struct dump dump = { 0 };
+	const char *center_touchpads = "on";
+	char line[128];
+	bool generate = false, model = false;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "c:e:gmh")) != -1) {
+		switch (opt) {
+		case 'c':
+			center_touchpads = optarg;
+			break;
+		case 'e':
+			dump.expected = fopen(optarg, "r");
+			if (!dump.expected) {
+				perror(optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'g':
+			generate = true;
+			break;
+		case 'm':
+			model = true;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (argc - optind != 1) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (generate) {
+		ret = write_corpus(argv[optind]);
+		if (ret < 0) {
+			fprintf(stderr, "Failed to write %s: %s\n",
+				argv[optind], strerror(-ret));
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	ret = sc_trace_open(&trace, argv[optind]);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", argv[optind],
+			strerror(-ret));
+		return EXIT_FAILURE;
+	}
+
+	if (model)
+		ret = run_model(&dump, &trace,
+				strcmp(center_touchpads, "off") != 0);
+	else
+		ret = run_driver(&dump, &trace, center_touchpads);
+
+	if (ret >= 0 && dump.expected && !dump.differs &&
+	    fgets(line, sizeof(line), dump.expected)) {
+		fprintf(stderr, "Missing events from line %lu:\nexpected: %s",
+			dump.line + 1, line);
+		dump.differs = true;
+	}
+
+	sc_trace_close(&trace);
+	if (dump.expected)
+		fclose(dump.expected);
+	return ret < 0 || dump.differs ? EXIT_FAILURE : EXIT_SUCCESS;
+}
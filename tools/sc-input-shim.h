@@ -0,0 +1,97 @@
+/*
+ * Userspace stand-in for the kernel input API used by the decoder
+ *
+ * Copyright (c) 2015 Clement Vuchener
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#ifndef SC_INPUT_SHIM_H
+#define SC_INPUT_SHIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <linux/input.h>
+
+typedef uint8_t u8;
+typedef int16_t s16;
+typedef uint32_t u32;
+
+/* Keeps the last values like the input core does to filter out events
+ * that do not change anything.
+ */
+struct input_dev {
+	int abs[ABS_CNT];
+	/* Set like input_set_abs_params would */
+	int fuzz[ABS_CNT];
+	bool key[KEY_CNT];
+	/* Events that would have been sent to userspace */
+	unsigned long events;
+	unsigned long syncs;
+	bool pending;
+	/* Optional callback for each event passed on */
+	void (*event)(struct input_dev *dev, unsigned int type,
+		      unsigned int code, int value);
+	void *data;
+};
+
+static inline void input_shim_event(struct input_dev *dev, unsigned int type,
+				    unsigned int code, int value)
+{
+	++dev->events;
+	dev->pending = true;
+	if (dev->event)
+		dev->event(dev, type, code, value);
+}
+
+/* Same filtering as input_defuzz_abs_event */
+static inline int input_shim_defuzz(int value, int old, int fuzz)
+{
+	if (fuzz) {
+		if (value > old - fuzz / 2 && value < old + fuzz / 2)
+			return old;
+		if (value > old - fuzz && value < old + fuzz)
+			return (old * 3 + value) / 4;
+		if (value > old - fuzz * 2 && value < old + fuzz * 2)
+			return (old + value) / 2;
+	}
+	return value;
+}
+
+static inline void input_report_abs(struct input_dev *dev, unsigned int code,
+				    int value)
+{
+	value = input_shim_defuzz(value, dev->abs[code], dev->fuzz[code]);
+	if (dev->abs[code] == value)
+		return;
+	dev->abs[code] = value;
+	input_shim_event(dev, EV_ABS, code, value);
+}
+
+static inline void input_report_key(struct input_dev *dev, unsigned int code,
+				    int value)
+{
+	if (dev->key[code] == !!value)
+		return;
+	dev->key[code] = !!value;
+	input_shim_event(dev, EV_KEY, code, !!value);
+}
+
+static inline void input_sync(struct input_dev *dev)
+{
+	/* Empty reports are dropped by the input core too */
+	if (!dev->pending)
+		return;
+	dev->pending = false;
+	++dev->syncs;
+	if (dev->event)
+		dev->event(dev, EV_SYN, SYN_REPORT, 0);
+}
+
+#endif
@@ -0,0 +1,267 @@
+/*
+ * Report to evdev event latency benchmark
+ *
+ * Copyright (c) 2015 Clement Vuchener
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#include "sc-emu.h"
+#include "sc-evdev.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MAX_LOAD	256
+
+enum {
+	LATENCY_BUTTON,
+	LATENCY_STICK,
+	LATENCY_SENSOR,
+	LATENCY_COUNT,
+};
+
+static const char *latency_names[LATENCY_COUNT] = {
+	"button", "stick", "sensor",
+};
+
+struct results {
+	uint64_t *samples[LATENCY_COUNT];
+	unsigned int count[LATENCY_COUNT];
+	unsigned int lost;
+};
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -r          use a receiver slot instead of a wired controller\n"
+		"  -n COUNT    number of samples per run (default 10000)\n"
+		"  -f RATE     samples per second (default 1000)\n"
+		"  -l COUNT    also run with COUNT busy processes loading the CPUs\n",
+		name);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile_us(uint64_t *samples, unsigned int count, double p)
+{
+	unsigned int index;
+
+	if (!count)
+		return 0.0;
+	index = p * (count - 1) / 100.0 + 0.5;
+	return samples[index] / 1000.0;
+}
+
+static void print_results(const char *run, struct results *results)
+{
+	int i;
+
+	for (i = 0; i < LATENCY_COUNT; ++i) {
+		qsort(results->samples[i], results->count[i],
+		      sizeof(uint64_t), compare_u64);
+		printf("%s %s samples=%u p50=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus\n",
+		       run, latency_names[i], results->count[i],
+		       percentile_us(results->samples[i], results->count[i], 50.0),
+		       percentile_us(results->samples[i], results->count[i], 99.0),
+		       percentile_us(results->samples[i], results->count[i], 99.9),
+		       percentile_us(results->samples[i], results->count[i], 100.0));
+	}
+	printf("%s lost=%u\n", run, results->lost);
+}
+
+/* Waits for the events caused by the frame sent at start */
+static void wait_events(struct sc_emu *emu, int fds[2], uint64_t start,
+			struct results *results)
+{
+	struct pollfd pfds[3];
+	struct input_event ev;
+	bool seen[LATENCY_COUNT] = { false };
+	unsigned int remaining = LATENCY_COUNT;
+	uint64_t deadline = start + 100000000ull;
+	int i, type;
+
+	pfds[0].fd = fds[0];
+	pfds[1].fd = fds[1];
+	pfds[2].fd = emu->fd;
+	for (i = 0; i < 3; ++i)
+		pfds[i].events = POLLIN;
+
+	while (remaining && sc_emu_now() < deadline) {
+		if (poll(pfds, 3, 10) < 0 && errno != EINTR)
+			break;
+		if (pfds[2].revents & POLLIN)
+			sc_emu_dispatch(emu);
+		sc_emu_flush(emu);
+
+		for (i = 0; i < 2; ++i) {
+			while (read(fds[i], &ev, sizeof(ev)) == sizeof(ev)) {
+				if (i == 1 && ev.type == EV_ABS && ev.code == ABS_X)
+					type = LATENCY_SENSOR;
+				else if (i == 0 && ev.type == EV_KEY && ev.code == BTN_SOUTH)
+					type = LATENCY_BUTTON;
+				else if (i == 0 && ev.type == EV_ABS && ev.code == ABS_X)
+					type = LATENCY_STICK;
+				else
+					continue;
+				if (seen[type])
+					continue;
+				seen[type] = true;
+				--remaining;
+				results->samples[type][results->count[type]++] =
+					sc_evdev_time(&ev) - start;
+			}
+		}
+	}
+	results->lost += remaining;
+}
+
+static int run(const char *name, struct sc_emu *emu, int fds[2],
+	       unsigned int samples, unsigned int rate)
+{
+	struct results results;
+	struct sc_state state;
+	uint64_t start, next;
+	unsigned int n;
+	int i;
+
+	memset(&results, 0, sizeof(results));
+	for (i = 0; i < LATENCY_COUNT; ++i) {
+		results.samples[i] = calloc(samples, sizeof(uint64_t));
+		if (!results.samples[i])
+			return -ENOMEM;
+	}
+
+	memset(&state, 0, sizeof(state));
+	next = sc_emu_now();
+	for (n = 0; n < samples; ++n) {
+		/* Change a button, the stick and the accelerometer */
+		state.buttons ^= SC_BTN_A;
+		state.left[0] = n % 2 ? 10000 : -10000;
+		state.accel[0] = n % 2 ? 1000 : -1000;
+
+		while (sc_emu_now() < next)
+			sc_emu_service(emu, (next - sc_emu_now()) / 1000000);
+		next += 1000000000ull / rate;
+
+		start = sc_emu_now();
+		if (sc_emu_send_state(emu, &state) <= 0) {
+			++results.lost;
+			continue;
+		}
+		wait_events(emu, fds, start, &results);
+	}
+
+	print_results(name, &results);
+	for (i = 0; i < LATENCY_COUNT; ++i)
+		free(results.samples[i]);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sc_emu_config config = {
+		.product = SC_PRODUCT_WIRED,
+		.serial = "LATENCY",
+	};
+	struct sc_emu emu;
+	pid_t load[MAX_LOAD];
+	unsigned int samples = 10000, rate = 1000, load_count = 0;
+	uint64_t deadline;
+	int fds[2] = { -1, -1 };
+	int opt, ret, i;
+
+	while ((opt = getopt(argc, argv, "rn:f:l:h")) != -1) {
+		switch (opt) {
+		case 'r':
+			config.product = SC_PRODUCT_RECEIVER;
+			break;
+		case 'n':
+			samples = atoi(optarg);
+			break;
+		case 'f':
+			rate = atoi(optarg);
+			break;
+		case 'l':
+			load_count = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (!samples || !rate || load_count > MAX_LOAD) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	ret = sc_emu_create(&emu, &config, 0);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to create uhid device: %s\n",
+			strerror(-ret));
+		return EXIT_FAILURE;
+	}
+	/* The receiver slot is connected when probed */
+	emu.connected = true;
+
+	/* Serve the initialization requests until the devices appear */
+	deadline = sc_emu_now() + 5000000000ull;
+	while ((fds[0] < 0 || fds[1] < 0) && sc_emu_now() < deadline) {
+		sc_emu_service(&emu, 10);
+		if (fds[0] < 0)
+			fds[0] = sc_evdev_open(emu.serial, false);
+		if (fds[1] < 0)
+			fds[1] = sc_evdev_open(emu.serial, true);
+	}
+	if (fds[0] < 0 || fds[1] < 0) {
+		fprintf(stderr, "Input devices for %s not found\n", emu.serial);
+		sc_emu_destroy(&emu);
+		return EXIT_FAILURE;
+	}
+
+	/* Let the open requests complete */
+	deadline = sc_emu_now() + 200000000ull;
+	while (sc_emu_now() < deadline)
+		sc_emu_service(&emu, 10);
+
+	ret = run("idle", &emu, fds, samples, rate);
+
+	if (ret == 0 && load_count) {
+		for (i = 0; i < (int)load_count; ++i) {
+			load[i] = fork();
+			if (load[i] == 0)
+				for (;;)
+					;
+		}
+		ret = run("loaded", &emu, fds, samples, rate);
+		for (i = 0; i < (int)load_count; ++i) {
+			if (load[i] > 0) {
+				kill(load[i], SIGKILL);
+				waitpid(load[i], NULL, 0);
+			}
+		}
+	}
+
+	close(fds[0]);
+	close(fds[1]);
+	sc_emu_destroy(&emu);
+	return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
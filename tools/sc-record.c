@@ -0,0 +1,168 @@
+/*
+ * Steam Controller report recorder
+ *
+ * Copyright (c) 2015 Clement Vuchener
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#include "sc-trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <linux/hidraw.h>
+
+static volatile sig_atomic_t stop;
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options] SOURCE OUTPUT\n"
+		"  -p PRODUCT  USB product id stored for debugfs captures\n"
+		"\n"
+		"SOURCE is a hidraw node, recorded until interrupted, or a file\n"
+		"read from the driver debugfs capture. OUTPUT may be - for stdout.\n",
+		name);
+}
+
+static void handle_signal(int sig)
+{
+	stop = 1;
+}
+
+static long record_hidraw(const char *path, const char *output)
+{
+	struct hidraw_devinfo info;
+	struct sc_trace trace;
+	struct sc_trace_record record;
+	struct sigaction sa;
+	uint64_t start;
+	long count = 0;
+	ssize_t len;
+	int fd, ret;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	if (ioctl(fd, HIDIOCGRAWINFO, &info) < 0) {
+		ret = -errno;
+		close(fd);
+		return ret;
+	}
+
+	ret = sc_trace_create(&trace, output, info.product);
+	if (ret < 0) {
+		close(fd);
+		return ret;
+	}
+
+	/* Interrupt the read on signals instead of restarting it */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	start = sc_emu_now();
+	while (!stop) {
+		len = read(fd, record.data, sizeof(record.data));
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			count = -errno;
+			break;
+		}
+		if (len != SC_FRAME_SIZE)
+			continue;
+		record.timestamp = sc_emu_now() - start;
+		ret = sc_trace_write(&trace, &record);
+		if (ret < 0) {
+			count = ret;
+			break;
+		}
+		++count;
+	}
+
+	sc_trace_close(&trace);
+	close(fd);
+	return count;
+}
+
+static long convert_capture(const char *path, const char *output,
+			    uint16_t product)
+{
+	struct sc_trace in, out;
+	struct sc_trace_record record;
+	long count = 0;
+	int ret;
+
+	ret = sc_trace_open(&in, path);
+	if (ret < 0)
+		return ret;
+	ret = sc_trace_create(&out, output, product ? product : in.product);
+	if (ret < 0) {
+		sc_trace_close(&in);
+		return ret;
+	}
+
+	while ((ret = sc_trace_read(&in, &record)) > 0) {
+		ret = sc_trace_write(&out, &record);
+		if (ret < 0)
+			break;
+		++count;
+	}
+
+	sc_trace_close(&out);
+	sc_trace_close(&in);
+	return ret < 0 ? ret : count;
+}
+
+int main(int argc, char *argv[])
+{
+	uint16_t product = 0;
+	struct stat st;
+	long count;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:h")) != -1) {
+		switch (opt) {
+		case 'p':
+			product = strtoul(optarg, NULL, 16);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (argc - optind != 2) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (stat(argv[optind], &st) < 0) {
+		perror(argv[optind]);
+		return EXIT_FAILURE;
+	}
+	if (S_ISCHR(st.st_mode))
+		count = record_hidraw(argv[optind], argv[optind+1]);
+	else
+		count = convert_capture(argv[optind], argv[optind+1], product);
+	if (count < 0) {
+		fprintf(stderr, "Recording failed: %s\n", strerror(-count));
+		return EXIT_FAILURE;
+	}
+
+	fprintf(stderr, "%ld reports recorded\n", count);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,240 @@
+/*
+ * Steam Controller report replay through an emulated device
+ *
+ * Copyright (c) 2015 Clement Vuchener
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#include "sc-emu.h"
+#include "sc-evdev.h"
+#include "sc-trace.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct replay {
+	struct sc_emu emu;
+	int evdev;
+	unsigned long sent, dropped, events;
+	uint64_t lateness_max;
+};
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options] TRACE\n"
+		"  -s SPEED    speed factor (default 1, 0 for as fast as possible)\n"
+		"  -p PRODUCT  USB product id of the device, when the trace has none\n"
+		"              (default 0x%04x)\n"
+		"  -l COUNT    number of times the trace is replayed (default 1)\n"
+		"  -v          log feature requests\n",
+		name, SC_PRODUCT_WIRED);
+}
+
+static long load_trace(const char *path, uint16_t *product,
+		       struct sc_trace_record **records)
+{
+	struct sc_trace trace;
+	struct sc_trace_record *tmp;
+	long count = 0, size = 0;
+	int ret;
+
+	ret = sc_trace_open(&trace, path);
+	if (ret < 0)
+		return ret;
+	if (trace.product)
+		*product = trace.product;
+
+	*records = NULL;
+	do {
+		if (count == size) {
+			size = size ? 2 * size : 1024;
+			tmp = realloc(*records, size * sizeof(**records));
+			if (!tmp) {
+				ret = -ENOMEM;
+				break;
+			}
+			*records = tmp;
+		}
+		ret = sc_trace_read(&trace, &(*records)[count]);
+		if (ret > 0)
+			++count;
+	} while (ret > 0);
+
+	sc_trace_close(&trace);
+	if (ret < 0) {
+		free(*records);
+		return ret;
+	}
+	return count;
+}
+
+/* Receiver slots start connected when input comes before any connection
+ * event.
+ */
+static bool starts_connected(const struct sc_trace_record *records, long count)
+{
+	long i;
+
+	for (i = 0; i < count; ++i) {
+		switch (records[i].data[2]) {
+		case SC_FRAME_INPUT:
+			return true;
+		case SC_FRAME_CONNECTION:
+			return records[i].data[4] != SC_CONNECTION_CONNECTED;
+		}
+	}
+	return false;
+}
+
+/* Keeps the gamepad node open so that the device is opened and polled */
+static void drain_evdev(struct replay *replay)
+{
+	struct input_event ev;
+	ssize_t ret;
+
+	if (replay->evdev < 0)
+		replay->evdev = sc_evdev_open(replay->emu.serial, false);
+	if (replay->evdev < 0)
+		return;
+
+	while ((ret = read(replay->evdev, &ev, sizeof(ev))) == sizeof(ev))
+		++replay->events;
+	/* The node is only gone once another controller paired */
+	if (ret < 0 && errno == ENODEV) {
+		close(replay->evdev);
+		replay->evdev = -1;
+	}
+}
+
+static void send_record(struct replay *replay,
+			const struct sc_trace_record *record)
+{
+	int ret;
+
+	/* The driver keeps its input nodes across disconnections */
+	if (record->data[2] == SC_FRAME_CONNECTION)
+		ret = sc_emu_send_connection(&replay->emu, record->data[4]);
+	else
+		ret = sc_emu_send_raw(&replay->emu, record->data);
+
+	if (ret > 0)
+		++replay->sent;
+	else
+		++replay->dropped;
+}
+
+int main(int argc, char *argv[])
+{
+	static struct replay replay = { .evdev = -1 };
+	struct sc_emu_config config = {
+		.product = SC_PRODUCT_WIRED,
+		.serial = "REPLAY",
+	};
+	struct sc_trace_record *records;
+	double speed = 1.0;
+	unsigned int loops = 1, loop;
+	uint64_t start, due, now, offset = 0, deadline;
+	long count, i;
+	int opt, ret, timeout;
+
+	while ((opt = getopt(argc, argv, "s:p:l:vh")) != -1) {
+		switch (opt) {
+		case 's':
+			speed = atof(optarg);
+			break;
+		case 'p':
+			config.product = strtoul(optarg, NULL, 16);
+			break;
+		case 'l':
+			loops = atoi(optarg);
+			break;
+		case 'v':
+			config.verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (argc - optind != 1 || speed < 0 || !loops) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	count = load_trace(argv[optind], &config.product, &records);
+	if (count <= 0) {
+		fprintf(stderr, "No reports in %s: %s\n", argv[optind],
+			count ? strerror(-count) : "empty trace");
+		return EXIT_FAILURE;
+	}
+
+	ret = sc_emu_create(&replay.emu, &config, 0);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to create uhid device: %s\n",
+			strerror(-ret));
+		free(records);
+		return EXIT_FAILURE;
+	}
+	if (starts_connected(records, count))
+		replay.emu.connected = true;
+
+	/* Wait for the driver to set the device up */
+	deadline = sc_emu_now() + 10000000000ull;
+	while (!replay.emu.opened && sc_emu_now() < deadline) {
+		sc_emu_service(&replay.emu, 10);
+		if (replay.emu.connected)
+			drain_evdev(&replay);
+	}
+	if (!replay.emu.opened) {
+		fprintf(stderr, "The device was not opened by the driver\n");
+		sc_emu_destroy(&replay.emu);
+		free(records);
+		return EXIT_FAILURE;
+	}
+
+	start = sc_emu_now();
+	for (loop = 0; loop < loops; ++loop) {
+		for (i = 0; i < count; ++i) {
+			due = start + (speed > 0 ?
+				       (offset + records[i].timestamp) / speed : 0);
+			while ((now = sc_emu_now()) < due) {
+				timeout = (due - now) / 1000000;
+				sc_emu_service(&replay.emu, timeout);
+				if (!timeout)
+					break;
+			}
+			sc_emu_service(&replay.emu, 0);
+			now = sc_emu_now();
+			if (now > due && now - due > replay.lateness_max)
+				replay.lateness_max = now - due;
+
+			send_record(&replay, &records[i]);
+			if (replay.emu.connected)
+				drain_evdev(&replay);
+		}
+		offset += records[count-1].timestamp;
+	}
+	now = sc_emu_now();
+
+	printf("reports: %lu sent, %lu dropped\n", replay.sent, replay.dropped);
+	printf("events: %lu\n", replay.events);
+	printf("duration: %.3f s (trace: %.3f s)\n", (now - start) / 1e9,
+	       offset / 1e9);
+	printf("max lateness: %.3f ms\n", replay.lateness_max / 1e6);
+
+	if (replay.evdev >= 0)
+		close(replay.evdev);
+	sc_emu_destroy(&replay.emu);
+	free(records);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,351 @@
+/*
+ * Multiple controllers scaling benchmark
+ *
+ * Copyright (c) 2015 Clement Vuchener
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#include "sc-emu.h"
+#include "sc-evdev.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define MAX_DEVICES	64
+#define SEND_RING	1024
+
+struct device {
+	struct sc_emu emu;
+	struct sc_state state;
+	unsigned int rate;
+	uint64_t next_frame;
+	int evdev;
+	char sysfs[300];
+	unsigned long frames_before;
+	/* Send times of the frames not seen on evdev yet */
+	uint64_t sent[SEND_RING];
+	unsigned int sent_head, sent_tail;
+};
+
+struct cpu_times {
+	unsigned long long system, irq, softirq;
+};
+
+static struct device devices[MAX_DEVICES];
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -m MODE     wired, receiver or mixed devices (default mixed)\n"
+		"  -N COUNT    maximum number of devices, doubled from 1 (default %d)\n"
+		"  -W RATE     wired controller report rate (default 1000)\n"
+		"  -R RATE     receiver slot report rate (default 250)\n"
+		"  -t SECONDS  duration of each step (default 5)\n",
+		name, MAX_DEVICES);
+}
+
+static int read_cpu_times(struct cpu_times *times)
+{
+	FILE *file;
+	unsigned long long user, nice, idle, iowait;
+	int ret;
+
+	file = fopen("/proc/stat", "r");
+	if (!file)
+		return -errno;
+	ret = fscanf(file, "cpu %llu %llu %llu %llu %llu %llu %llu",
+		     &user, &nice, &times->system, &idle, &iowait,
+		     &times->irq, &times->softirq);
+	fclose(file);
+	return ret == 7 ? 0 : -EIO;
+}
+
+static unsigned long read_frames(struct device *device)
+{
+	char value[32];
+
+	if (sc_sysfs_read(device->sysfs, "statistics/frames_input",
+			  value, sizeof(value)) < 0)
+		return 0;
+	return strtoul(value, NULL, 10);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile_us(uint64_t *samples, size_t count, double p)
+{
+	size_t index;
+
+	if (!count)
+		return 0.0;
+	index = p * (count - 1) / 100.0 + 0.5;
+	return samples[index] / 1000.0;
+}
+
+static double timeval_ms(const struct timeval *tv)
+{
+	return tv->tv_sec * 1000.0 + tv->tv_usec / 1000.0;
+}
+
+static int setup(int count, const char *mode, unsigned int wired_rate,
+		 unsigned int receiver_rate)
+{
+	struct sc_emu_config config = {
+		.serial = "SCALE",
+	};
+	uint64_t deadline;
+	bool wired;
+	int i, ret, missing;
+
+	for (i = 0; i < count; ++i) {
+		if (strcmp(mode, "mixed") == 0)
+			wired = i % 2 == 0;
+		else
+			wired = strcmp(mode, "wired") == 0;
+		config.product = wired ? SC_PRODUCT_WIRED : SC_PRODUCT_RECEIVER;
+
+		memset(&devices[i], 0, sizeof(devices[i]));
+		devices[i].evdev = -1;
+		devices[i].rate = wired ? wired_rate : receiver_rate;
+		ret = sc_emu_create(&devices[i].emu, &config, i);
+		if (ret < 0)
+			return ret;
+		devices[i].emu.connected = true;
+	}
+
+	deadline = sc_emu_now() + 10000000000ull;
+	do {
+		missing = 0;
+		for (i = 0; i < count; ++i) {
+			sc_emu_service(&devices[i].emu, 1);
+			if (devices[i].evdev < 0)
+				devices[i].evdev = sc_evdev_open(devices[i].emu.serial,
+								 false);
+			if (devices[i].evdev < 0)
+				++missing;
+		}
+	} while (missing && sc_emu_now() < deadline);
+	if (missing)
+		return -ENOENT;
+
+	for (i = 0; i < count; ++i) {
+		ret = sc_sysfs_find(i, devices[i].sysfs,
+				    sizeof(devices[i].sysfs));
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+static void teardown(int count)
+{
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		if (devices[i].evdev >= 0)
+			close(devices[i].evdev);
+		sc_emu_destroy(&devices[i].emu);
+	}
+}
+
+static int step(int count, unsigned int duration, bool first)
+{
+	static struct pollfd fds[2 * MAX_DEVICES];
+	struct cpu_times cpu_before, cpu_after;
+	struct rusage usage_before, usage_after;
+	struct input_event ev;
+	struct device *device;
+	uint64_t *samples;
+	size_t samples_count = 0, samples_size;
+	unsigned long sent = 0, received = 0, syn_dropped = 0, lost = 0;
+	uint64_t start, end, now, next;
+	long hz = sysconf(_SC_CLK_TCK);
+	int i, timeout;
+
+	samples_size = 0;
+	for (i = 0; i < count; ++i)
+		samples_size += (size_t)devices[i].rate * duration;
+	samples = malloc((samples_size + 1) * sizeof(uint64_t));
+	if (!samples)
+		return -ENOMEM;
+
+	for (i = 0; i < count; ++i) {
+		fds[2*i].fd = devices[i].emu.fd;
+		fds[2*i].events = POLLIN;
+		fds[2*i+1].fd = devices[i].evdev;
+		fds[2*i+1].events = POLLIN;
+		devices[i].frames_before = read_frames(&devices[i]);
+	}
+
+	read_cpu_times(&cpu_before);
+	getrusage(RUSAGE_SELF, &usage_before);
+	start = sc_emu_now();
+	end = start + duration * 1000000000ull;
+	for (i = 0; i < count; ++i)
+		devices[i].next_frame = start;
+
+	while ((now = sc_emu_now()) < end) {
+		next = end;
+		for (i = 0; i < count; ++i) {
+			device = &devices[i];
+			if (device->rate && device->next_frame <= now) {
+				device->state.buttons ^= SC_BTN_A;
+				device->state.left[0] = device->state.left[0] > 0 ?
+							-10000 : 10000;
+				now = sc_emu_now();
+				if (sc_emu_send_state(&device->emu, &device->state) > 0) {
+					++sent;
+					/* Forget the oldest frame if evdev lags too much */
+					if (device->sent_head - device->sent_tail == SEND_RING)
+						++device->sent_tail;
+					device->sent[device->sent_head++ % SEND_RING] = now;
+				}
+				device->next_frame += 1000000000ull / device->rate;
+			}
+			if (device->rate && device->next_frame < next)
+				next = device->next_frame;
+		}
+
+		now = sc_emu_now();
+		timeout = next > now ? (next - now) / 1000000 : 0;
+		if (poll(fds, 2 * count, timeout) < 0 && errno != EINTR)
+			break;
+
+		for (i = 0; i < count; ++i) {
+			device = &devices[i];
+			if (fds[2*i].revents & POLLIN)
+				sc_emu_dispatch(&device->emu);
+			sc_emu_flush(&device->emu);
+
+			while (read(device->evdev, &ev, sizeof(ev)) == sizeof(ev)) {
+				if (ev.type != EV_SYN)
+					continue;
+				if (ev.code == SYN_DROPPED) {
+					++syn_dropped;
+					continue;
+				}
+				if (ev.code != SYN_REPORT ||
+				    device->sent_tail == device->sent_head)
+					continue;
+				++received;
+				if (samples_count <= samples_size)
+					samples[samples_count++] = sc_evdev_time(&ev) -
+						device->sent[device->sent_tail % SEND_RING];
+				++device->sent_tail;
+			}
+		}
+	}
+	end = sc_emu_now();
+	getrusage(RUSAGE_SELF, &usage_after);
+	read_cpu_times(&cpu_after);
+
+	/* Frames sent to uhid but never decoded by the driver */
+	for (i = 0; i < count; ++i) {
+		unsigned long frames = read_frames(&devices[i]) -
+				       devices[i].frames_before;
+		unsigned long written = devices[i].sent_head;
+
+		if (written > frames)
+			lost += written - frames;
+	}
+
+	qsort(samples, samples_count, sizeof(uint64_t), compare_u64);
+	timersub(&usage_after.ru_stime, &usage_before.ru_stime,
+		 &usage_after.ru_stime);
+	printf("%s  {\"devices\": %d, \"duration_ms\": %.1f, "
+	       "\"frames_sent\": %lu, \"frames_lost\": %lu, "
+	       "\"events_received\": %lu, \"syn_dropped\": %lu, "
+	       "\"injector_system_ms\": %.1f, "
+	       "\"system_ms\": %.1f, \"irq_ms\": %.1f, \"softirq_ms\": %.1f, "
+	       "\"latency_us\": {\"p50\": %.1f, \"p99\": %.1f, \"p99.9\": %.1f, \"max\": %.1f}}",
+	       first ? "" : ",\n", count, (end - start) / 1000000.0,
+	       sent, lost, received, syn_dropped,
+	       timeval_ms(&usage_after.ru_stime),
+	       (cpu_after.system - cpu_before.system) * 1000.0 / hz,
+	       (cpu_after.irq - cpu_before.irq) * 1000.0 / hz,
+	       (cpu_after.softirq - cpu_before.softirq) * 1000.0 / hz,
+	       percentile_us(samples, samples_count, 50.0),
+	       percentile_us(samples, samples_count, 99.0),
+	       percentile_us(samples, samples_count, 99.9),
+	       percentile_us(samples, samples_count, 100.0));
+	fflush(stdout);
+
+	free(samples);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *mode = "mixed";
+	unsigned int wired_rate = 1000, receiver_rate = 250, duration = 5;
+	int max = MAX_DEVICES, count, opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "m:N:W:R:t:h")) != -1) {
+		switch (opt) {
+		case 'm':
+			mode = optarg;
+			break;
+		case 'N':
+			max = atoi(optarg);
+			break;
+		case 'W':
+			wired_rate = atoi(optarg);
+			break;
+		case 'R':
+			receiver_rate = atoi(optarg);
+			break;
+		case 't':
+			duration = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (max < 1 || max > MAX_DEVICES || !duration ||
+	    (strcmp(mode, "mixed") != 0 && strcmp(mode, "wired") != 0 &&
+	     strcmp(mode, "receiver") != 0)) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	printf("{\"mode\": \"%s\", \"wired_rate\": %u, \"receiver_rate\": %u,\n"
+	       " \"steps\": [\n", mode, wired_rate, receiver_rate);
+	for (count = 1; count <= max; count = count < max && count * 2 > max ?
+					       max : count * 2) {
+		ret = setup(count, mode, wired_rate, receiver_rate);
+		if (ret == 0)
+			ret = step(count, duration, count == 1);
+		teardown(count);
+		if (ret < 0) {
+			fprintf(stderr, "Step with %d devices failed: %s\n",
+				count, strerror(-ret));
+			break;
+		}
+		if (count == max)
+			break;
+		/* Let the driver release the devices */
+		usleep(500000);
+	}
+	printf("\n ]}\n");
+	return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,347 @@
+/*
+ * Connection storm soak benchmark
+ *
+ * Copyright (c) 2015 Clement Vuchener
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#include "sc-emu.h"
+#include "sc-evdev.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define SERIAL_PREFIX	"STORM"
+#define MAX_PHASES	16
+
+struct storm {
+	struct sc_emu emu;
+	struct sc_state state;
+	char sysfs[300];
+	int gamepad;
+	unsigned int rate;
+	uint64_t next_frame;
+	unsigned long frames;
+	/* Connection waiting for its first event */
+	bool waiting;
+	uint64_t connect_time;
+	int16_t expected;
+	/* Samples of the current phase */
+	uint64_t *latencies;
+	size_t latency_count;
+};
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -n CYCLES   connect/disconnect cycles per phase (default 1000)\n"
+		"  -P LIST     connected and disconnected periods of the phases in ms,\n"
+		"              varied by +/-50%% (default 100,20,5,1)\n"
+		"  -f RATE     input frames per second (default 250)\n"
+		"  -p          pair a new controller before each connection\n",
+		name);
+}
+
+static long meminfo_kb(const char *key)
+{
+	FILE *file;
+	char line[128];
+	size_t len = strlen(key);
+	long value = -1;
+
+	file = fopen("/proc/meminfo", "r");
+	if (!file)
+		return -1;
+	while (fgets(line, sizeof(line), file)) {
+		if (strncmp(line, key, len) == 0 && line[len] == ':') {
+			value = strtol(line + len + 1, NULL, 10);
+			break;
+		}
+	}
+	fclose(file);
+	return value;
+}
+
+/* Input nodes of every controller ever emulated, leaked ones included */
+static int count_nodes(void)
+{
+	DIR *dir;
+	struct dirent *entry;
+	char uniq[64];
+	int count = 0;
+
+	dir = opendir("/sys/class/input");
+	if (!dir)
+		return -errno;
+	while ((entry = readdir(dir))) {
+		if (strncmp(entry->d_name, "event", 5) == 0 &&
+		    sc_input_read(entry->d_name, "uniq", uniq, sizeof(uniq)) >= 0 &&
+		    strncmp(uniq, SERIAL_PREFIX, strlen(SERIAL_PREFIX)) == 0)
+			++count;
+	}
+	closedir(dir);
+	return count;
+}
+
+static long read_sysfs_long(const struct storm *storm, const char *attr)
+{
+	char value[64];
+
+	if (sc_sysfs_read(storm->sysfs, attr, value, sizeof(value)) < 0)
+		return -1;
+	return strtol(value, NULL, 10);
+}
+
+static int16_t abs_x(int fd)
+{
+	struct input_absinfo absinfo;
+
+	if (fd < 0 || ioctl(fd, EVIOCGABS(ABS_X), &absinfo) < 0)
+		return INT16_MIN;
+	return absinfo.value;
+}
+
+static void first_event(struct storm *storm, uint64_t time)
+{
+	storm->latencies[storm->latency_count++] = time - storm->connect_time;
+	storm->waiting = false;
+}
+
+/* Keeps frames flowing and watches the gamepad for some time */
+static void hold(struct storm *storm, unsigned int ms)
+{
+	uint64_t end = sc_emu_now() + ms * 1000000ull;
+	uint64_t now;
+	struct input_event ev;
+	ssize_t ret = 0;
+
+	while ((now = sc_emu_now()) < end) {
+		if (storm->emu.connected && now >= storm->next_frame) {
+			if (sc_emu_send_state(&storm->emu, &storm->state) > 0)
+				++storm->frames;
+			storm->next_frame += 1000000000ull / storm->rate;
+			if (storm->next_frame < now)
+				storm->next_frame = now;
+		}
+
+		/* A new node may have missed its first event before the
+		 * open, its current state tells if it came.
+		 */
+		if (storm->gamepad < 0 && storm->emu.connected) {
+			storm->gamepad = sc_evdev_open(storm->emu.serial, false);
+			if (storm->waiting &&
+			    abs_x(storm->gamepad) == storm->expected)
+				first_event(storm, sc_emu_now());
+		}
+		while (storm->gamepad >= 0 &&
+		       (ret = read(storm->gamepad, &ev, sizeof(ev))) == sizeof(ev)) {
+			if (storm->waiting && ev.type == EV_ABS &&
+			    ev.code == ABS_X && ev.value == storm->expected)
+				first_event(storm, sc_evdev_time(&ev));
+		}
+		/* The node is gone once another controller paired */
+		if (storm->gamepad >= 0 && ret < 0 && errno == ENODEV) {
+			close(storm->gamepad);
+			storm->gamepad = -1;
+		}
+
+		sc_emu_service(&storm->emu, 1);
+	}
+}
+
+static void connect_slot(struct storm *storm, bool pair, unsigned int cycle)
+{
+	if (pair) {
+		sc_emu_send_connection(&storm->emu, SC_CONNECTION_PAIRED);
+		snprintf(storm->emu.serial, sizeof(storm->emu.serial),
+			 SERIAL_PREFIX "%u", cycle);
+	}
+
+	/* Every connection moves the stick somewhere else */
+	storm->expected = storm->expected == 10000 ? -10000 : 10000;
+	storm->state.left[0] = storm->expected;
+	storm->waiting = true;
+	storm->connect_time = sc_emu_now();
+	storm->next_frame = storm->connect_time;
+	sc_emu_send_connection(&storm->emu, SC_CONNECTION_CONNECTED);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile_us(uint64_t *samples, size_t count, double p)
+{
+	size_t index;
+
+	if (!count)
+		return 0.0;
+	index = p * (count - 1) / 100.0 + 0.5;
+	return samples[index] / 1000.0;
+}
+
+static unsigned int vary(unsigned int ms)
+{
+	return ms / 2 + rand() % (ms + 1);
+}
+
+static void run_phase(struct storm *storm, unsigned int period,
+		      unsigned int cycles, bool pair, bool first)
+{
+	static unsigned int serial_cycle;
+	long slab_before, slab_after, flaps_before, frames_before;
+	long reconnect_max, lifecycle_max;
+	unsigned long frames;
+	unsigned int cycle, missed = 0;
+	bool recovered, neutral;
+	char value[64];
+
+	sc_sysfs_write(storm->sysfs, "work_latency", "0");
+	flaps_before = read_sysfs_long(storm, "connection_flaps");
+	frames_before = read_sysfs_long(storm, "statistics/frames_input");
+	slab_before = meminfo_kb("Slab");
+	frames = storm->frames;
+	storm->latency_count = 0;
+
+	for (cycle = 0; cycle < cycles; ++cycle) {
+		connect_slot(storm, pair, ++serial_cycle);
+		hold(storm, vary(period));
+		if (storm->waiting)
+			++missed;
+		storm->waiting = false;
+		sc_emu_send_connection(&storm->emu, SC_CONNECTION_DISCONNECTED);
+		hold(storm, vary(period));
+	}
+
+	/* After the storm, the slot must work again and end up neutral */
+	hold(storm, 1000);
+	connect_slot(storm, false, serial_cycle);
+	hold(storm, 2000);
+	recovered = !storm->waiting;
+	storm->waiting = false;
+	sc_emu_send_connection(&storm->emu, SC_CONNECTION_DISCONNECTED);
+	hold(storm, 1000);
+	neutral = abs_x(storm->gamepad) == 0;
+
+	slab_after = meminfo_kb("Slab");
+	lifecycle_max = read_sysfs_long(storm, "work_latency");
+	reconnect_max = -1;
+	if (sc_sysfs_read(storm->sysfs, "reconnect_latency", value,
+			  sizeof(value)) > 0)
+		sscanf(value, "%*d %ld", &reconnect_max);
+
+	qsort(storm->latencies, storm->latency_count, sizeof(uint64_t),
+	      compare_u64);
+	printf("%s  {\"period_ms\": %u, \"cycles\": %u, "
+	       "\"missed_first_event\": %u, \"flaps\": %ld, "
+	       "\"frames_sent\": %lu, \"frames_lost\": %ld, "
+	       "\"lifecycle_work_max_us\": %ld, \"reconnect_max_us\": %ld, "
+	       "\"slab_delta_kb\": %ld, \"input_nodes\": %d, "
+	       "\"recovered\": %s, \"neutral\": %s, "
+	       "\"first_event_us\": {\"p50\": %.1f, \"p99\": %.1f, "
+	       "\"max\": %.1f}}",
+	       first ? "" : ",\n", period, cycles, missed,
+	       read_sysfs_long(storm, "connection_flaps") - flaps_before,
+	       storm->frames - frames,
+	       (long)(storm->frames - frames) -
+	       (read_sysfs_long(storm, "statistics/frames_input") - frames_before),
+	       lifecycle_max, reconnect_max, slab_after - slab_before,
+	       count_nodes(), recovered ? "true" : "false",
+	       neutral ? "true" : "false",
+	       percentile_us(storm->latencies, storm->latency_count, 50.0),
+	       percentile_us(storm->latencies, storm->latency_count, 99.0),
+	       percentile_us(storm->latencies, storm->latency_count, 100.0));
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+	static struct storm storm = { .gamepad = -1, .rate = 250 };
+	struct sc_emu_config config = {
+		.product = SC_PRODUCT_RECEIVER,
+		.serial = SERIAL_PREFIX,
+	};
+	unsigned int periods[MAX_PHASES] = { 100, 20, 5, 1 };
+	unsigned int phase_count = 4, cycles = 1000, i;
+	long slab_start;
+	bool pair = false;
+	char *token;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "n:P:f:ph")) != -1) {
+		switch (opt) {
+		case 'n':
+			cycles = atoi(optarg);
+			break;
+		case 'P':
+			phase_count = 0;
+			for (token = strtok(optarg, ","); token &&
+			     phase_count < MAX_PHASES; token = strtok(NULL, ","))
+				periods[phase_count++] = atoi(token);
+			break;
+		case 'f':
+			storm.rate = atoi(optarg);
+			break;
+		case 'p':
+			pair = true;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (!cycles || !phase_count || !storm.rate) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	storm.latencies = malloc((cycles + 1) * sizeof(uint64_t));
+	if (!storm.latencies)
+		return EXIT_FAILURE;
+
+	ret = sc_emu_create(&storm.emu, &config, 0);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to create uhid device: %s\n",
+			strerror(-ret));
+		return EXIT_FAILURE;
+	}
+	while (!storm.emu.opened)
+		sc_emu_service(&storm.emu, 10);
+	ret = sc_sysfs_find(storm.emu.index, storm.sysfs, sizeof(storm.sysfs));
+	if (ret < 0) {
+		fprintf(stderr, "Failed to find the device in sysfs: %s\n",
+			strerror(-ret));
+		sc_emu_destroy(&storm.emu);
+		return EXIT_FAILURE;
+	}
+
+	srand(1);
+	slab_start = meminfo_kb("Slab");
+	printf("{\"pair\": %s, \"rate\": %u,\n \"phases\": [\n",
+	       pair ? "true" : "false", storm.rate);
+	for (i = 0; i < phase_count; ++i)
+		run_phase(&storm, periods[i], cycles, pair, i == 0);
+	printf("\n ],\n \"slab_delta_kb\": %ld}\n", meminfo_kb("Slab") - slab_start);
+
+	if (storm.gamepad >= 0)
+		close(storm.gamepad);
+	sc_emu_destroy(&storm.emu);
+	free(storm.latencies);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,120 @@
+/*
+ * Steam Controller report trace files
+ *
+ * Copyright (c) 2015 Clement Vuchener
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#include "sc-trace.h"
+
+#include <errno.h>
+#include <string.h>
+
+static uint64_t get_le(const uint8_t *p, int size)
+{
+	uint64_t value = 0;
+	int i;
+
+	for (i = 0; i < size; ++i)
+		value |= (uint64_t)p[i] << i*8;
+	return value;
+}
+
+static void put_le(uint8_t *p, uint64_t value, int size)
+{
+	int i;
+
+	for (i = 0; i < size; ++i)
+		p[i] = value >> i*8;
+}
+
+int sc_trace_open(struct sc_trace *trace, const char *path)
+{
+	uint8_t header[SC_TRACE_HEADER_SIZE];
+
+	memset(trace, 0, sizeof(*trace));
+	trace->file = fopen(path, "rb");
+	if (!trace->file)
+		return -errno;
+
+	if (fread(header, sizeof(header), 1, trace->file) == 1 &&
+	    memcmp(header, SC_TRACE_MAGIC, sizeof(SC_TRACE_MAGIC)) == 0) {
+		if (get_le(&header[8], 2) != SC_TRACE_VERSION) {
+			fclose(trace->file);
+			return -EPROTO;
+		}
+		trace->product = get_le(&header[10], 2);
+		return 0;
+	}
+
+	/* Debugfs capture */
+	trace->raw = true;
+	trace->base = get_le(header, 8);
+	if (fseek(trace->file, 0, SEEK_SET) < 0) {
+		fclose(trace->file);
+		return -errno;
+	}
+	return 0;
+}
+
+int sc_trace_create(struct sc_trace *trace, const char *path,
+		    uint16_t product)
+{
+	uint8_t header[SC_TRACE_HEADER_SIZE] = SC_TRACE_MAGIC;
+
+	memset(trace, 0, sizeof(*trace));
+	trace->product = product;
+	trace->file = strcmp(path, "-") == 0 ? stdout : fopen(path, "wb");
+	if (!trace->file)
+		return -errno;
+
+	put_le(&header[8], SC_TRACE_VERSION, 2);
+	put_le(&header[10], product, 2);
+	if (fwrite(header, sizeof(header), 1, trace->file) != 1) {
+		sc_trace_close(trace);
+		return -EIO;
+	}
+	return 0;
+}
+
+void sc_trace_close(struct sc_trace *trace)
+{
+	if (trace->file && trace->file != stdout)
+		fclose(trace->file);
+	else if (trace->file)
+		fflush(trace->file);
+	trace->file = NULL;
+}
+
+int sc_trace_read(struct sc_trace *trace, struct sc_trace_record *record)
+{
+	uint8_t buf[SC_TRACE_RECORD_SIZE];
+
+	if (fread(buf, sizeof(buf), 1, trace->file) != 1)
+		return ferror(trace->file) ? -EIO : 0;
+
+	record->timestamp = get_le(buf, 8);
+	if (trace->raw)
+		record->timestamp = record->timestamp >= trace->base ?
+				    record->timestamp - trace->base : 0;
+	memcpy(record->data, &buf[8], SC_FRAME_SIZE);
+	return 1;
+}
+
+int sc_trace_write(struct sc_trace *trace,
+		   const struct sc_trace_record *record)
+{
+	uint8_t buf[SC_TRACE_RECORD_SIZE];
+
+	put_le(buf, record->timestamp, 8);
+	memcpy(&buf[8], record->data, SC_FRAME_SIZE);
+	if (fwrite(buf, sizeof(buf), 1, trace->file) != 1)
+		return -EIO;
+	return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * Steam Controller report trace files
+ *
+ * Copyright (c) 2015 Clement Vuchener
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#ifndef SC_TRACE_H
+#define SC_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sc-emu.h"
+
+/* A trace is a 16-byte header followed by records in the same format as
+ * the driver debugfs capture, all little-endian:
+ *
+ *   header: "SCTRACE\0", u16 version, u16 USB product id (0 if unknown),
+ *           u32 reserved
+ *   record: u64 timestamp in ns from the start of the trace, 64-byte report
+ *
+ * A headerless debugfs capture is read as a trace of unknown product with
+ * timestamps made relative to its first record.
+ */
+#define SC_TRACE_MAGIC		"SCTRACE"
+#define SC_TRACE_VERSION	1
+#define SC_TRACE_HEADER_SIZE	16
+#define SC_TRACE_RECORD_SIZE	(8 + SC_FRAME_SIZE)
+
+struct sc_trace_record {
+	uint64_t timestamp;
+	uint8_t data[SC_FRAME_SIZE];
+};
+
+struct sc_trace {
+	FILE *file;
+	uint16_t product;
+	/* Subtracted from the timestamps of headerless captures */
+	uint64_t base;
+	bool raw;
+};
+
+/* Opens a trace or a debugfs capture for reading */
+int sc_trace_open(struct sc_trace *trace, const char *path);
+/* Creates a trace for writing, "-" is stdout */
+int sc_trace_create(struct sc_trace *trace, const char *path,
+		    uint16_t product);
+void sc_trace_close(struct sc_trace *trace);
+
+/* Returns 1 if a record was read, 0 at the end of the trace */
+int sc_trace_read(struct sc_trace *trace, struct sc_trace_record *record);
+int sc_trace_write(struct sc_trace *trace,
+		   const struct sc_trace_record *record);
+
+#endif